@@ -0,0 +1,152 @@
+#include <string.h>
+#include <stdexcept>
+
+#include "ActivityScheduler.h"
+#include "Papaya.h"
+
+// an enemy within this range puts a platoon in the contact tier
+static const float contactRange = 12.0f;
+// ticks between refreshing whether there are enemies in contact range
+static const unsigned int contactCheckInterval = 4;
+
+static unsigned int tierUpdateInterval(UpdateTier t)
+{
+	switch(t) {
+		case UpdateTier::Contact:
+			return 1;
+		case UpdateTier::Marching:
+			return 4;
+		case UpdateTier::Reserve:
+			return 16;
+	}
+	return 1;
+}
+
+ActivityScheduler::ActivityScheduler()
+	: mTick(0)
+{
+	memset(mTierCounts, 0x00, sizeof(mTierCounts));
+}
+
+void ActivityScheduler::addPlatoon(Platoon* p)
+{
+	p->setActivity(Activity::Awake);
+	mAwake.push_back(Slot(p));
+}
+
+void ActivityScheduler::wake(Platoon* p)
+{
+	switch(p->getActivity()) {
+		case Activity::Awake:
+			break;
+
+		case Activity::Drowsy:
+			// still in mAwake - just cancel the sleep
+			p->setActivity(Activity::Awake);
+			break;
+
+		case Activity::Asleep:
+			p->setActivity(Activity::Awake);
+			mAwake.push_back(Slot(p));
+			break;
+	}
+}
+
+void ActivityScheduler::sleep(Platoon* p)
+{
+	if(p->getActivity() != Activity::Awake)
+		return;
+	p->setActivity(Activity::Drowsy);
+}
+
+// Appends the platoons whose update changed something to changed.
+void ActivityScheduler::update(float dt, std::vector<Platoon*>& changed)
+{
+	memset(mTierCounts, 0x00, sizeof(mTierCounts));
+	// platoons woken up during the loop are appended and updated as well
+	for(size_t i = 0; i < mAwake.size(); i++) {
+		Slot& s = mAwake[i];
+		UpdateTier t = getTier(s);
+		mTierCounts[int(t)]++;
+		s.mPendingTime += dt;
+		// stagger the reduced rate updates over the ticks
+		if((mTick + s.mPlatoon->getEntityID()) % tierUpdateInterval(t) == 0) {
+			float pending = s.mPendingTime;
+			Platoon* p = s.mPlatoon;
+			s.mPendingTime = 0.0f;
+			// s may be invalidated by platoons woken up during the update
+			p->update(pending, changed);
+		}
+	}
+	removeSleeping();
+	mTick++;
+}
+
+UpdateTier ActivityScheduler::getTier(Slot& s)
+{
+	Posture posture = s.mPlatoon->getPosture();
+	if(posture == Posture::Engaged)
+		return UpdateTier::Contact;
+	if((mTick + s.mPlatoon->getEntityID()) % contactCheckInterval == 0)
+		s.mNearEnemy = Papaya::instance().hasEnemiesNear(s.mPlatoon, contactRange);
+	if(s.mNearEnemy)
+		return UpdateTier::Contact;
+	if(posture == Posture::Moving)
+		return UpdateTier::Marching;
+	return UpdateTier::Reserve;
+}
+
+void ActivityScheduler::removeSleeping()
+{
+	size_t j = 0;
+	for(size_t i = 0; i < mAwake.size(); i++) {
+		Platoon* p = mAwake[i].mPlatoon;
+		if(p->getActivity() == Activity::Drowsy) {
+			p->setActivity(Activity::Asleep);
+		}
+		else {
+			mAwake[j++] = mAwake[i];
+		}
+	}
+	mAwake.erase(mAwake.begin() + j, mAwake.end());
+}
+
+void ActivityScheduler::saveState(CheckpointWriter& w) const
+{
+	w.write(mTick);
+	w.write<unsigned int>(mAwake.size());
+	for(auto& s : mAwake) {
+		w.writePlatoon(s.mPlatoon);
+		w.write(s.mPendingTime);
+		w.write(s.mNearEnemy);
+	}
+}
+
+// The activities of the platoons are loaded with the platoons.
+void ActivityScheduler::loadState(CheckpointReader& r)
+{
+	mTick = r.read<unsigned int>();
+	unsigned int n = r.read<unsigned int>();
+	mAwake.clear();
+	for(unsigned int i = 0; i < n; i++) {
+		Platoon* p = r.readPlatoon();
+		if(!p)
+			throw std::runtime_error("Checkpoint has an invalid awake platoon");
+		Slot s(p);
+		s.mPendingTime = r.read<float>();
+		s.mNearEnemy = r.read<bool>();
+		mAwake.push_back(s);
+	}
+}
+
+size_t ActivityScheduler::getNumAwake() const
+{
+	return mAwake.size();
+}
+
+// Number of awake platoons in the given tier during the last update.
+size_t ActivityScheduler::getNumInTier(UpdateTier t) const
+{
+	return mTierCounts[int(t)];
+}
+
@@ -0,0 +1,44 @@
+#ifndef ACTIVITYSCHEDULER_H
+#define ACTIVITYSCHEDULER_H
+
+#include <stdlib.h>
+#include <vector>
+
+#include "MilitaryUnit.h"
+#include "Checkpoint.h"
+
+// Keeps track of which platoons need to be updated each tick. Settled
+// platoons are put to sleep and only woken up by events: an incoming
+// message (including their own visibility check discovering an enemy)
+// or a friendly unit moving into separation range.
+// Awake platoons are updated at a rate depending on their update tier:
+// platoons in or near contact every tick, others less often with the
+// skipped time accumulated.
+class ActivityScheduler {
+	public:
+		ActivityScheduler();
+		void addPlatoon(Platoon* p);
+		void wake(Platoon* p);
+		void sleep(Platoon* p);
+		void update(float dt, std::vector<Platoon*>& changed);
+		size_t getNumAwake() const;
+		size_t getNumInTier(UpdateTier t) const;
+		void saveState(CheckpointWriter& w) const;
+		void loadState(CheckpointReader& r);
+	private:
+		struct Slot {
+			Slot(Platoon* p)
+				: mPlatoon(p), mPendingTime(0.0f), mNearEnemy(false) { }
+			Platoon* mPlatoon;
+			float mPendingTime;
+			bool mNearEnemy;
+		};
+		void removeSleeping();
+		UpdateTier getTier(Slot& s);
+		std::vector<Slot> mAwake;
+		unsigned int mTick;
+		size_t mTierCounts[3];
+};
+
+#endif
+
@@ -6,11 +6,22 @@
 #include <memory>
 #include <iostream>
 #include <exception>
+#include <atomic>
+#include <thread>
 
 #include "App.h"
 #include "GUIController.h"
+#include "Trace.h"
 
 static const float lineHeight = 0.51f;
+static const float markerHeight = 0.1f;
+// formations closer to the camera than this times their size relative to
+// a company are drawn as their subunits
+static const float markerLodDistance = 60.0f;
+// cells per side of the marker grids used for picking
+static const int markerGridCells = 64;
+static const float simulationStep = 0.01f;
+static const float ticksPerSecond = 60.0f;
 
 App::App()
 	: mUpVelocity(0),
@@ -18,13 +29,15 @@ App::App()
 	mForwardVelocity(0),
 	mMapRenderType(0),
 	mUnitScale(UnitSize::Platoon),
-	mUnitScaleChanged(true),
+	mAutoUnitScale(true),
 	mWindowWidth(0),
 	mWindowHeight(0),
 	mTimeScale(1),
 	mOwnUnit(nullptr),
-	mObserver(false)
+	mObserver(false),
+	mSimulation(mTerrain, simulationStep, ticksPerSecond)
 {
+	double starttime = Clock::getTime();
 	Papaya::instance().setup(&mTerrain);
 	// get user data directory
 	char* homedir = getenv("HOME");
@@ -72,36 +85,50 @@ App::App()
 		mCamNode->setPosition(64, 64, 50.0f);
 		mCamera->lookAt(64, 64, 0);
 
-		mRaySceneQuery = mScene->createRayQuery(Ogre::Ray());
-
 		initResources();
 
 		initInput();
 		checkWindowResize();
 
-		createUnitMesh();
+		createUnitMarkers();
 		createExtraMaterials();
 		createTerrain();
-		Papaya::instance().addEventListener(this);
-		MessageDispatcher::instance().registerWorldEntity(this);
 		if(!mObserver)
 			setupHumanControls();
 
+		createMarkerTables();
+		mSimulation.publishFrame();
+		updateUnits();
 		focusOnControlledUnit(0);
 
 		mRunning = true;
+		std::cout << "Started in " << (Clock::getTime() - starttime) * 1000.0 << " ms\n";
 	}
 }
 
 App::~App()
 {
-	mScene->destroyQuery(mRaySceneQuery);
+	mSimulation.stop();
 	mWindow->removeAllViewports();
 	mScene->destroyAllCameras();
 	mScene->destroyAllEntities();
+	mScene->destroyAllBillboardSets();
+	mRootNode->detachObject(mLines.get());
+	mTerrainRenderer.reset();
 	mRootNode->removeAndDestroyAllChildren();
 }
 
+// The unit controlled by the player, or -1 in observer mode.
+EntityID App::getHumanUnit() const
+{
+	return mOwnUnit ? mOwnUnit->getEntityID() : -1;
+}
+
+SimulationThread& App::getSimulation()
+{
+	return mSimulation;
+}
+
 void App::setupHumanControls()
 {
 	std::shared_ptr<Army> a = Papaya::instance().getArmy(0);
@@ -115,6 +142,7 @@ void App::setupHumanControls()
 		m->setController(c);
 		for(auto& p : m->getPlatoons()) {
 			mControlledUnits.push_back(std::pair<MilitaryUnit*, std::shared_ptr<GUIController>>(p, c));
+			mHumanUnits.insert(p);
 		}
 	}
 }
@@ -154,16 +182,188 @@ void App::initInput()
 	mKeyboard->setEventCallback(this);
 	mMouse = static_cast<OIS::Mouse*>(mInputManager->createInputObject(OIS::OISMouse, true));
 	mMouse->setEventCallback(this);
+	// OIS clamps the mouse to this size, which checkWindowResize only
+	// sets when the size changes
+	mMouse->getMouseState().width = mWindowWidth;
+	mMouse->getMouseState().height = mWindowHeight;
 }
 
-void App::createUnitMesh()
+// The index of the marker scale units of this size are shown on, or -1
+// if they have no markers.
+static int getMarkerScale(UnitSize s)
+{
+	switch(s) {
+		case UnitSize::Platoon: return 0;
+		case UnitSize::Company: return 1;
+		case UnitSize::Battalion: return 2;
+		case UnitSize::Brigade: return 3;
+		default: return -1;
+	}
+}
+
+static float getMarkerSize(UnitSize s)
+{
+	float scale = 1.0f;
+	switch(s) {
+		case UnitSize::Single: scale = 0.1f; break;
+		case UnitSize::Squad: scale = 0.5f; break;
+		case UnitSize::Platoon: scale = 1.0f; break;
+		case UnitSize::Company: scale = 2.0f; break;
+		case UnitSize::Battalion: scale = 4.0f; break;
+		case UnitSize::Brigade: scale = 8.0f; break;
+		case UnitSize::Division: scale = 16.0f; break;
+	}
+	return 0.4f * scale;
+}
+
+static const UnitSize markerSizes[NUM_MARKER_SCALES] = {
+	UnitSize::Platoon, UnitSize::Company, UnitSize::Battalion, UnitSize::Brigade
+};
+
+static size_t getIconIndex(ServiceBranch b, int scale, bool human, bool selected)
+{
+	return ((size_t(b) * NUM_MARKER_SCALES + scale) * 2 + human) * 2 + selected;
+}
+
+// The markers of each scale are billboards in one set, so that the draw
+// calls don't grow with the number of units. The icon of a marker is
+// chosen by its texture coordinates in the icon atlas.
+void App::createUnitMarkers()
 {
-	Ogre::Plane plane(Ogre::Vector3::UNIT_Z, 0.0f);
-	Ogre::MeshManager::getSingleton().createPlane("UnitMesh",
-			APP_RESOURCE_NAME, plane, 0.4f, 0.4f, 4, 4, true,
-			1, 1.0f, 1.0f, Ogre::Vector3::UNIT_Y);
 	mTeamColors[1] = Ogre::ColourValue(0.42, 0.65, 1.0);
 	mTeamColors[2] = Ogre::ColourValue(1.0, 0.42, 0.42);
+
+	std::vector<Ogre::FloatRect> coords;
+	createUnitIconAtlas(coords);
+	Ogre::MaterialPtr material = Ogre::MaterialManager::getSingleton().create("UnitIconMaterial",
+			APP_RESOURCE_NAME);
+	Ogre::Pass* pass = material->getTechnique(0)->getPass(0);
+	// the team colour comes from the billboard colour
+	pass->setLightingEnabled(false);
+	pass->setSceneBlending(Ogre::SBT_TRANSPARENT_ALPHA);
+	pass->setDepthWriteEnabled(false);
+	// flat markers would cut into the slopes
+	pass->setDepthCheckEnabled(false);
+	pass->createTextureUnitState("UnitIconAtlas");
+
+	for(int i = 0; i < NUM_MARKER_SCALES; i++) {
+		float size = getMarkerSize(markerSizes[i]);
+		Ogre::BillboardSet* set = mScene->createBillboardSet(std::string(unitSizeToName(markerSizes[i])) + "Markers", 64);
+		set->setMaterialName("UnitIconMaterial", APP_RESOURCE_NAME);
+		set->setTextureCoords(&coords[0], coords.size());
+		// lying on the ground like the terrain
+		set->setBillboardType(Ogre::BBT_PERPENDICULAR_COMMON);
+		set->setCommonDirection(Ogre::Vector3::UNIT_Z);
+		set->setCommonUpVector(Ogre::Vector3::UNIT_Y);
+		set->setDefaultDimensions(size, size);
+		set->setAutoextend(true);
+		// drawn after the terrain and the order lines
+		set->setRenderQueueGroup(Ogre::RENDER_QUEUE_7);
+		mRootNode->attachObject(set);
+		mUnitBillboardSets[i] = set;
+	}
+	float size = getMarkerSize(markerSizes[NUM_MARKER_SCALES - 1]);
+	setMarkerBounds(Ogre::AxisAlignedBox(-size, -size, 0.0f,
+				mTerrain.getWidth() + size, mTerrain.getWidth() + size,
+				mTerrain.getHeightScale() + 1.0f));
+}
+
+// The sets are culled by the bounds given here rather than by the bounds
+// of their billboards, which OGRE doesn't update when a marker moves.
+void App::setMarkerBounds(const Ogre::AxisAlignedBox& box)
+{
+	mMarkerBounds = box;
+	const Ogre::Vector3& min = box.getMinimum();
+	const Ogre::Vector3& max = box.getMaximum();
+	Ogre::Vector3 corner(std::max(-min.x, max.x), std::max(-min.y, max.y), std::max(-min.z, max.z));
+	for(int i = 0; i < NUM_MARKER_SCALES; i++)
+		mUnitBillboardSets[i]->setBounds(box, corner.length());
+}
+
+#define ICON_SIZE 64
+#define ICON_ATLAS_COLUMNS 16
+
+// The icon as floating point RGBA.
+static std::vector<float> loadIcon(const std::string& filename)
+{
+	Ogre::Image img;
+	img.load(filename, APP_RESOURCE_NAME);
+	if(img.getWidth() != ICON_SIZE || img.getHeight() != ICON_SIZE)
+		throw std::runtime_error("Icon " + filename + " is not the right size.\n");
+	std::vector<float> data(ICON_SIZE * ICON_SIZE * 4);
+	Ogre::PixelBox box(ICON_SIZE, ICON_SIZE, 1, Ogre::PF_FLOAT32_RGBA, &data[0]);
+	Ogre::PixelUtil::bulkPixelConversion(img.getPixelBox(), box);
+	return data;
+}
+
+// Blends the layer over the icon.
+static void blendIcon(std::vector<float>& icon, const std::vector<float>& layer)
+{
+	for(size_t i = 0; i < icon.size(); i += 4) {
+		float a = layer[i + 3];
+		for(int j = 0; j < 3; j++)
+			icon[i + j] = layer[i + j] * a + icon[i + j] * (1.0f - a);
+		icon[i + 3] = std::min(1.0f, icon[i + 3] + a);
+	}
+}
+
+// Composes the icon of every branch, size, human control and selection
+// combination into one texture once at startup, the way the old
+// per-unit materials layered the textures, so that changing a marker
+// only changes its texture coordinates. The coordinates of each icon
+// are stored at its index.
+void App::createUnitIconAtlas(std::vector<Ogre::FloatRect>& coords)
+{
+	const size_t numicons = NUM_SERVICE_BRANCHES * NUM_MARKER_SCALES * 2 * 2;
+	const size_t rows = (numicons + ICON_ATLAS_COLUMNS - 1) / ICON_ATLAS_COLUMNS;
+	const size_t width = ICON_ATLAS_COLUMNS * ICON_SIZE;
+	size_t height = ICON_SIZE;
+	while(height < rows * ICON_SIZE)
+		height *= 2;
+	std::vector<Ogre::uint8> atlas(width * height * 4, 0);
+	coords.resize(numicons);
+
+	std::vector<float> sizeicons[NUM_MARKER_SCALES];
+	for(int i = 0; i < NUM_MARKER_SCALES; i++)
+		sizeicons[i] = loadIcon(std::string(unitSizeToName(markerSizes[i])) + ".png");
+	std::vector<float> spot = loadIcon("Spot.png");
+
+	for(int b = 0; b < NUM_SERVICE_BRANCHES; b++) {
+		std::vector<float> branchicon = loadIcon(std::string(branchToName(ServiceBranch(b))) + ".png");
+		for(int i = 0; i < NUM_MARKER_SCALES; i++) {
+			for(int human = 0; human < 2; human++) {
+				for(int selected = 0; selected < 2; selected++) {
+					std::vector<float> icon = branchicon;
+					blendIcon(icon, sizeicons[i]);
+					if(human) {
+						for(size_t k = 0; k < icon.size(); k += 4) {
+							icon[k + 1] *= 0.5f;
+							icon[k + 2] *= 0.5f;
+						}
+					}
+					if(selected)
+						blendIcon(icon, spot);
+
+					size_t index = getIconIndex(ServiceBranch(b), i, human, selected);
+					size_t x0 = (index % ICON_ATLAS_COLUMNS) * ICON_SIZE;
+					size_t y0 = (index / ICON_ATLAS_COLUMNS) * ICON_SIZE;
+					for(size_t y = 0; y < ICON_SIZE; y++) {
+						Ogre::uint8* dst = &atlas[((y0 + y) * width + x0) * 4];
+						const float* src = &icon[y * ICON_SIZE * 4];
+						for(size_t x = 0; x < ICON_SIZE * 4; x++)
+							dst[x] = Ogre::uint8(Ogre::Math::Clamp(src[x], 0.0f, 1.0f) * 255.0f + 0.5f);
+					}
+					// half a texel in so that the neighbours don't bleed in
+					coords[index] = Ogre::FloatRect((x0 + 0.5f) / width, (y0 + 0.5f) / height,
+							(x0 + ICON_SIZE - 0.5f) / width, (y0 + ICON_SIZE - 0.5f) / height);
+				}
+			}
+		}
+	}
+
+	Ogre::Image img;
+	img.loadDynamicImage(&atlas[0], width, height, 1, Ogre::PF_BYTE_RGBA);
+	Ogre::TextureManager::getSingleton().loadImage("UnitIconAtlas", APP_RESOURCE_NAME, img);
 }
 
 void App::createExtraMaterials()
@@ -176,35 +376,11 @@ void App::createExtraMaterials()
 	lineMaterial->getTechnique(0)->getPass(0)->setDiffuse(0,0,1,0); 
 	lineMaterial->getTechnique(0)->getPass(0)->setAmbient(0,0,1); 
 	lineMaterial->getTechnique(0)->getPass(0)->setSelfIllumination(0,0,1); 
-}
-
-void App::createTexture(const std::string& name, size_t width, size_t height,
-		std::function<std::tuple<Ogre::uint8, Ogre::uint8, Ogre::uint8> (size_t, size_t)> func)
-{
-	Ogre::TexturePtr texture = Ogre::TextureManager::getSingleton().createManual(name,
-			APP_RESOURCE_NAME,
-			Ogre::TEX_TYPE_2D,
-			width, height,
-			0,
-			Ogre::PF_BYTE_BGRA,
-			Ogre::TU_DEFAULT);
-	Ogre::HardwarePixelBufferSharedPtr pixelBuffer = texture->getBuffer();
-	pixelBuffer->lock(Ogre::HardwareBuffer::HBL_NORMAL);
-	const Ogre::PixelBox& pixelBox = pixelBuffer->getCurrentLock();
-	Ogre::uint8* pDest = static_cast<Ogre::uint8*>(pixelBox.data);
+	lineMaterial->getTechnique(0)->getPass(0)->setDepthCheckEnabled(false);
 
-	for (size_t j = 0; j < height; j++) {
-		for(size_t i = 0; i < width; i++) {
-			auto tpl = func(i, j);
-			*pDest++ = std::get<2>(tpl);
-			*pDest++ = std::get<1>(tpl);
-			*pDest++ = std::get<0>(tpl);
-			*pDest++ = 255; // A
-		}
-	}
-
-	// Unlock the pixel buffer
-	pixelBuffer->unlock();
+	mLines.reset(new OrderLineBatch("LineMaterial", mTerrain, lineHeight));
+	mLines->setRenderQueueGroup(Ogre::RENDER_QUEUE_6);
+	mRootNode->attachObject(mLines.get());
 }
 
 static const char* materialnames[] = { "TerrainMaterial", "HeightMaterial", "VegetationMaterial"};
@@ -213,34 +389,96 @@ void App::updateTerrain()
 {
 	if(mMapRenderType > 2)
 		mMapRenderType = 0;
-	mScene->getEntity("plane1")->setMaterialName(materialnames[mMapRenderType]);
+	mTerrainRenderer->setMaterial(materialnames[mMapRenderType]);
 }
 
+// rows baked by a thread at a time
+static const size_t terrain_tile_rows = 16;
+
+// Bakes the terrain, height and vegetation textures in one pass, in
+// tiles of rows spread over all cores. Each row of the terrain is
+// rasterised once and written to all three locked pixel buffers.
 void App::createTerrainTextures()
 {
 	const char* texturenames[] = { "TerrainTexture", "HeightTexture", "VegetationTexture"};
-	createTexture(texturenames[0], mTerrain.getWidth(), mTerrain.getWidth(), [&](size_t i, size_t j) {
-			float tHeight = mTerrain.getHeightAt(Vector2(i, j));
-			float tVeg = mTerrain.getVegetationAt(Vector2(i, j));
-			float heightDiff = (tHeight - mTerrain.getHeightAt(Vector2(i - 1, j))) * mTerrain.getHeightScale();
-			float texLen = sqrt(heightDiff * heightDiff + 1);
-			float lightnessCoeff = 1.0f + heightDiff * 0.8f / texLen;
-			float r, g, b;
-			r = (1.0f - tVeg) * 135 * lightnessCoeff; // R
-			g = 135 * lightnessCoeff; // G
-			b = (1.0f - tVeg) * 135 * lightnessCoeff; // B
-			return std::tuple<Ogre::uint8, Ogre::uint8, Ogre::uint8>(r, g, b);
-			});
-
-	createTexture(texturenames[1], mTerrain.getWidth(), mTerrain.getWidth(), [&](size_t i, size_t j) {
-                        float r = mTerrain.getHeightAt(Vector2(i, j)) * 255;
-			return std::tuple<Ogre::uint8, Ogre::uint8, Ogre::uint8>(r, r, r);
-			});
-
-	createTexture(texturenames[2], mTerrain.getWidth(), mTerrain.getWidth(), [&](size_t i, size_t j) {
-                        float r = mTerrain.getVegetationAt(Vector2(i, j)) * 255;
-			return std::tuple<Ogre::uint8, Ogre::uint8, Ogre::uint8>(r * 0.2f, r, r * 0.2f);
-			});
+	double starttime = Clock::getTime();
+	const size_t width = mTerrain.getWidth();
+	Ogre::HardwarePixelBufferSharedPtr buffers[3];
+	Ogre::uint8* pixels[3];
+	size_t pitches[3];
+	for(int i = 0; i < 3; i++) {
+		Ogre::TexturePtr texture = Ogre::TextureManager::getSingleton().createManual(texturenames[i],
+				APP_RESOURCE_NAME,
+				Ogre::TEX_TYPE_2D,
+				width, width,
+				0,
+				Ogre::PF_BYTE_BGRA,
+				Ogre::TU_DEFAULT);
+		buffers[i] = texture->getBuffer();
+		buffers[i]->lock(Ogre::HardwareBuffer::HBL_DISCARD);
+		const Ogre::PixelBox& pixelBox = buffers[i]->getCurrentLock();
+		pixels[i] = static_cast<Ogre::uint8*>(pixelBox.data);
+		pitches[i] = pixelBox.rowPitch * 4;
+	}
+
+	std::atomic<size_t> nextrow(0);
+	auto bake = [&]() {
+		// the height raster starts one texel left for the shading
+		std::vector<float> heights(width + 1);
+		std::vector<float> vegetation(width);
+		while(1) {
+			size_t firstrow = nextrow.fetch_add(terrain_tile_rows);
+			if(firstrow >= width)
+				break;
+			size_t lastrow = std::min(firstrow + terrain_tile_rows, width);
+			for(size_t j = firstrow; j < lastrow; j++) {
+				for(size_t i = 0; i <= width; i++)
+					heights[i] = mTerrain.getHeightAt(Vector2(float(i) - 1.0f, j));
+				for(size_t i = 0; i < width; i++)
+					vegetation[i] = mTerrain.getVegetationAt(Vector2(i, j));
+
+				// BGRA
+				Ogre::uint8* terrain = pixels[0] + j * pitches[0];
+				Ogre::uint8* height = pixels[1] + j * pitches[1];
+				Ogre::uint8* veg = pixels[2] + j * pitches[2];
+				for(size_t i = 0; i < width; i++) {
+					float tHeight = heights[i + 1];
+					float tVeg = vegetation[i];
+					float heightDiff = (tHeight - heights[i]) * mTerrain.getHeightScale();
+					float texLen = sqrt(heightDiff * heightDiff + 1);
+					float lightnessCoeff = 1.0f + heightDiff * 0.8f / texLen;
+					terrain[i * 4 + 0] = (1.0f - tVeg) * 135 * lightnessCoeff;
+					terrain[i * 4 + 1] = 135 * lightnessCoeff;
+					terrain[i * 4 + 2] = (1.0f - tVeg) * 135 * lightnessCoeff;
+					terrain[i * 4 + 3] = 255;
+
+					Ogre::uint8 h = tHeight * 255;
+					height[i * 4 + 0] = h;
+					height[i * 4 + 1] = h;
+					height[i * 4 + 2] = h;
+					height[i * 4 + 3] = 255;
+
+					float v = tVeg * 255;
+					veg[i * 4 + 0] = v * 0.2f;
+					veg[i * 4 + 1] = v;
+					veg[i * 4 + 2] = v * 0.2f;
+					veg[i * 4 + 3] = 255;
+				}
+			}
+		}
+	};
+	unsigned int numthreads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::thread> threads;
+	for(unsigned int i = 1; i < numthreads; i++)
+		threads.push_back(std::thread(bake));
+	bake();
+	for(auto& t : threads)
+		t.join();
+
+	for(int i = 0; i < 3; i++)
+		buffers[i]->unlock();
+	std::cout << "Baked the terrain textures in " << (Clock::getTime() - starttime) * 1000.0
+		<< " ms with " << numthreads << " threads\n";
 
 	// Create a material using the texture
 	for(int i = 0; i < 3; i++) {
@@ -254,52 +492,67 @@ void App::createTerrainTextures()
 void App::createTerrain()
 {
 	createTerrainTextures();
-	mTerrainPlane = Ogre::Plane(Ogre::Vector3::UNIT_Z, 0.0f);
-	Ogre::MeshManager::getSingleton().createPlane("terrain1",
-			APP_RESOURCE_NAME, mTerrainPlane, 128, 128, 4, 4, true,
-			1, 1.0f, 1.0f, Ogre::Vector3::UNIT_Y);
-	Ogre::Entity* planeEnt = mScene->createEntity("plane1", "terrain1");
-	updateTerrain();
-	planeEnt->setCastShadows(false);
-	Ogre::SceneNode* planeNode = mRootNode->createChildSceneNode();
-	planeNode->attachObject(planeEnt);
-	planeNode->setPosition(64, 64, 0);
+	mTerrainRenderer.reset(new TerrainRenderer(mTerrain, mScene, materialnames[mMapRenderType]));
+	mTerrainRenderer->start();
 }
 
 void App::run()
 {
+	TRACE_THREAD("renderer");
+	mSimulation.setTimeScale(mTimeScale);
+	mSimulation.start();
 	while(mRunning && !mWindow->isClosed()) {
-		Papaya::instance().process(mTimeScale * 0.01f);
-		setupUnitDisplay();
-		mRoot->renderOneFrame();
-		checkWindowResize();
-		Ogre::WindowEventUtilities::messagePump();
-		mKeyboard->capture();
-		mMouse->capture();
-		mCamNode->translate(mRightVelocity, mUpVelocity, mForwardVelocity);
-		updateCommandLines();
-		mClock.limitFPS(60);
+		TRACE_ZONE("Frame");
+		{
+			TRACE_ZONE("Sync units");
+			mSimulation.runRendererTasks();
+			updateUnits();
+		}
+		{
+			TRACE_ZONE("Terrain");
+			mTerrainRenderer->update();
+		}
+		{
+			TRACE_ZONE("Render");
+			mRoot->renderOneFrame();
+		}
+		{
+			TRACE_ZONE("Input");
+			checkWindowResize();
+			Ogre::WindowEventUtilities::messagePump();
+			mKeyboard->capture();
+			mMouse->capture();
+			mCamNode->translate(mRightVelocity, mUpVelocity, mForwardVelocity);
+		}
+		{
+			TRACE_ZONE("Order lines");
+			updateCommandLines();
+		}
+		{
+			TRACE_ZONE("Wait");
+			mClock.limitFPS(60);
+		}
 	}
+	mSimulation.stop();
+	mSimulation.getTickTimes().print(std::cout, "Tick time");
+	mClock.printStatistics(std::cout);
 }
 
 void App::updateCommandLines()
 {
 	for(auto it = mOrderLines.begin(); it != mOrderLines.end(); ) {
-		std::stringstream linename;
-		linename << "Orders " << it->first->getEntityID();
-		if(it->first->isDead() || (it->first->getPosition() - it->second).length() < 0.8f) {
-			deleteLine(linename.str());
+		Ogre::Vector3 pos;
+		const Ogre::Vector3& target = it->second.mTarget;
+		if(!getPlatoonPosition(it->first, pos) || Vector2(target.x - pos.x, target.y - pos.y).length() < 0.8f) {
+			mLines->removeSegment(it->second.mSegment);
 			mOrderLines.erase(it++);
-			continue;
 		}
 		else {
-			std::vector<Vector2> points;
-			points.push_back(it->first->getPosition());
-			points.push_back(it->second);
-			createLine(linename.str(), points);
+			mLines->setSegment(it->second.mSegment, pos, target);
 			++it;
 		}
 	}
+	mLines->update();
 }
 
 bool App::checkWindowResize()
@@ -319,26 +572,6 @@ bool App::checkWindowResize()
 	return false;
 }
 
-void App::setupUnitDisplay()
-{
-	if(!mUnitScaleChanged)
-		return;
-
-	mUnitScaleChanged = false;
-	for(auto& it : mPlatoonEntities) {
-		it.second.mNode->setVisible(mUnitScale == UnitSize::Platoon);
-	}
-	for(auto& it : mCompanyEntities) {
-		it.second.mNode->setVisible(mUnitScale == UnitSize::Company);
-	}
-	for(auto& it : mBattalionEntities) {
-		it.second.mNode->setVisible(mUnitScale == UnitSize::Battalion);
-	}
-	for(auto& it : mBrigadeEntities) {
-		it.second.mNode->setVisible(mUnitScale == UnitSize::Brigade);
-	}
-}
-
 bool App::keyPressed(const OIS::KeyEvent &arg)
 {
 	static const float movevel = 0.5f;
@@ -382,35 +615,44 @@ bool App::keyPressed(const OIS::KeyEvent &arg)
 		case OIS::KC_4:
 			focusOnControlledUnit(3);
 			break;
+		case OIS::KC_NUMPAD0:
+			mAutoUnitScale = true;
+			break;
 		case OIS::KC_NUMPAD1:
 		case OIS::KC_NUMPAD2:
 		case OIS::KC_NUMPAD3:
 			mUnitScale = UnitSize::Platoon;
-			mUnitScaleChanged = true;
+			mAutoUnitScale = false;
 			break;
 		case OIS::KC_NUMPAD4:
 			mUnitScale = UnitSize::Company;
-			mUnitScaleChanged = true;
+			mAutoUnitScale = false;
 			break;
 		case OIS::KC_NUMPAD5:
 			mUnitScale = UnitSize::Battalion;
-			mUnitScaleChanged = true;
+			mAutoUnitScale = false;
 			break;
 		case OIS::KC_NUMPAD6:
 		case OIS::KC_NUMPAD7:
 			mUnitScale = UnitSize::Brigade;
-			mUnitScaleChanged = true;
+			mAutoUnitScale = false;
 			break;
 		case OIS::KC_ADD:
 			if(mTimeScale < 128)
 				mTimeScale *= 2;
+			mSimulation.setTimeScale(mTimeScale);
 			std::cout << "Time scale: " << mTimeScale << "\n";
 			break;
 		case OIS::KC_SUBTRACT:
 			if(mTimeScale > 1)
 				mTimeScale /= 2;
+			mSimulation.setTimeScale(mTimeScale);
 			std::cout << "Time scale: " << mTimeScale << "\n";
 			break;
+		case OIS::KC_MULTIPLY:
+			mSimulation.setMaxSpeed(!mSimulation.getMaxSpeed());
+			std::cout << "Max speed: " << (mSimulation.getMaxSpeed() ? "on" : "off") << "\n";
+			break;
 		default:
 			break;
 	}
@@ -443,68 +685,43 @@ bool App::mouseMoved(const OIS::MouseEvent& arg)
 	return true;
 }
 
-std::pair<bool, Ogre::Real> rayPlaneIntersection(const Ogre::Plane& plane,
-		const Ogre::Ray& ray)
-{
-	using namespace Ogre;
-	Real denom = plane.normal.dotProduct(ray.getDirection());
-	if (Math::Abs(denom) < std::numeric_limits<Real>::epsilon())
-	{   
-		// Parallel
-		return std::pair<bool, Real>(false, 0);
-	}
-	else
-	{   
-		Real nom = plane.normal.dotProduct(ray.getOrigin()) + plane.d;
-		Real t = -(nom/denom);
-		return std::pair<bool, Real>(t >= 0, t);
-	}
-}
-
 bool App::mousePressed(const OIS::MouseEvent& arg, OIS::MouseButtonID button)
 {
 	Ogre::Ray mouseRay = mCamera->getCameraToViewportRay(arg.state.X.abs / float(arg.state.width),
 			arg.state.Y.abs / float(arg.state.height));
-	mRaySceneQuery->setRay(mouseRay);
-	mRaySceneQuery->setSortByDistance(true);
-	Ogre::RaySceneQueryResult& result = mRaySceneQuery->execute();
 
-	Vector2 point;
 	Ogre::Vector3 ogrepoint;
-	// Calling mouseRay.intersects(mTerrainPlane) returns invalid results with g++ 4.7.0.
-	// So copy the implementation from OGRE here and call that instead, which works. Weird.
-	std::pair<bool, float> intres = rayPlaneIntersection(mTerrainPlane, mouseRay);
-	if(intres.first) {
-		ogrepoint = mouseRay.getPoint(intres.second);
-		point = Vector2(ogrepoint.x, ogrepoint.y);
-	}
+	if(!mTerrainRenderer->intersectRay(mouseRay, ogrepoint))
+		return true;
+	Vector2 point(ogrepoint.x, ogrepoint.y);
 
 	if(button == OIS::MB_Left) {
-		for (Ogre::RaySceneQueryResult::iterator itr = result.begin(); itr != result.end(); itr++) {
-			// Is this result a MovableObject?
-			if (itr->movable && itr->movable->getName() != std::string("Camera"))
-			{
-				std::cout << "MovableObject: " << itr->movable->getName() << "\n";
-				Ogre::Entity* e = dynamic_cast<Ogre::Entity*>(itr->movable);
-				if(e) {
-					setSelectedUnit(e);
-				}
-			}
+		MilitaryUnit* m = pickUnit(point);
+		if(m) {
+			std::cout << "Selected unit " << m->getEntityID() << "\n";
+			setSelectedUnit(m);
 		}
 	}
-	else if(button == OIS::MB_Right && intres.first) {
-		for(auto& pair : mSelectedUnits) {
-			if(humanControlled(pair.first)) {
-				MessageDispatcher::instance().dispatchMessage(Message(mOwnUnit->getEntityID(),
-							pair.first->getEntityID(),
-							0.0f, 0.0f, MessageType::Goto, point));
-				std::stringstream linename;
-				linename << "Orders " << pair.first->getEntityID();
-				std::vector<Vector2> points;
-				points.push_back(pair.first->getPosition());
-				points.push_back(point);
-				createLine(linename.str(), points);
-				mOrderLines[pair.first] = point;
+	else if(button == OIS::MB_Right) {
+		for(auto m : mSelectedUnits) {
+			Ogre::Vector3 pos;
+			if(humanControlled(m) && getPlatoonPosition(m, pos)) {
+				// a creation time given so that the message doesn't read
+				// the simulation time - it is set when the order is injected
+				mSimulation.postOrder(Message(mOwnUnit->getEntityID(),
+							m->getEntityID(),
+							0.01f, 0.0f, MessageType::Goto, point));
+				auto it = mOrderLines.find(m);
+				if(it == mOrderLines.end()) {
+					OrderLine l;
+					l.mTarget = ogrepoint;
+					l.mSegment = mLines->addSegment(pos, ogrepoint);
+					mOrderLines.insert(std::make_pair(m, l));
+				}
+				else {
+					it->second.mTarget = ogrepoint;
+					mLines->setSegment(it->second.mSegment, pos, ogrepoint);
+				}
 			}
 		}
 	}
@@ -516,261 +733,421 @@ bool App::mouseReleased(const OIS::MouseEvent& arg, OIS::MouseButtonID button)
 	return true;
 }
 
-void App::receiveMessage(const Message& m)
+// Changes the icon of the marker of the unit, e.g. after it was selected.
+void App::updateUnitIcon(const MilitaryUnit& m)
 {
-	switch(m.mType) {
-		case MessageType::PlatoonDied:
-			PlatoonStatusChanged(m.mData->platoon);
-			break;
-		default:
-			std::cout << "Unhandled message " << int(m.mType) << " in App.\n";
-			break;
-	}
+	Ogre::Billboard* b = getUnitMarker(&m);
+	if(b)
+		b->setTexcoordIndex(getUnitIcon(m));
 }
 
-void App::updateUnitMaterial(const MilitaryUnit& m, Ogre::Entity* ent)
+Ogre::Billboard* App::getUnitMarker(const MilitaryUnit* m) const
 {
-	const std::string unittype(branchToName(m.getBranch()));
-	const std::string unitsize(unitSizeToName(m.getUnitSize()));
-	std::string materialname = getUnitMaterialName(m);
-	Ogre::MaterialPtr material = Ogre::MaterialManager::getSingleton().getByName(materialname,
-			APP_RESOURCE_NAME);
-	if(material.isNull()) {
-		Ogre::LogManager::getSingleton().stream() << "Creating material " << materialname << "\n";
-		material = Ogre::MaterialManager::getSingleton().create(materialname,
-				APP_RESOURCE_NAME);
-		material->setAmbient(mTeamColors[m.getSide()]);
-		material->getTechnique(0)->getPass(0)->setSceneBlending(Ogre::SBT_TRANSPARENT_ALPHA);
-		material->getTechnique(0)->getPass(0)->setDepthWriteEnabled(false);
-		std::string texturename1 = unittype + ".png";
-		std::string texturename2 = unitsize + ".png";
-		Ogre::TextureUnitState* t1 = material->getTechnique(0)->getPass(0)->createTextureUnitState(texturename1);
-		t1->setColourOperation(Ogre::LBO_MODULATE);
-		t1->setAlphaOperation(Ogre::LBX_MODULATE);
-		Ogre::TextureUnitState* t2 = material->getTechnique(0)->getPass(0)->createTextureUnitState(texturename2);
-		t2->setColourOperation(Ogre::LBO_ALPHA_BLEND);
-		t2->setAlphaOperation(Ogre::LBX_ADD);
-		if(humanControlled(&m)) {
-			Ogre::TextureUnitState* t3 = material->getTechnique(0)->getPass(0)->createTextureUnitState();
-			t3->setColourOperationEx(Ogre::LBX_MODULATE, Ogre::LBS_MANUAL, Ogre::LBS_CURRENT,
-					Ogre::ColourValue(1.0, 0.5, 0.5, 1.0));
-		}
-		if(unitSelected(&m)) {
-			Ogre::TextureUnitState* t4 = material->getTechnique(0)->getPass(0)->createTextureUnitState("Spot.png");
-			t4->setColourOperation(Ogre::LBO_ALPHA_BLEND);
-			t4->setAlphaOperation(Ogre::LBX_ADD);
-		}
+	auto it = mPlatoonIndices.find(m);
+	if(it != mPlatoonIndices.end())
+		return mPlatoonMarkers[it->second].mBillboard;
+	it = mFormationIndices.find(m);
+	if(it != mFormationIndices.end())
+		return mFormationMarkers[it->second].mBillboard;
+	return nullptr;
+}
+
+// Markers lie just above the ground.
+Ogre::Billboard* App::createUnitMarker(const MilitaryUnit& m, const Ogre::Vector3& ground)
+{
+	int scale = getMarkerScale(m.getUnitSize());
+	assert(scale >= 0);
+	Ogre::Vector3 pos = ground + Ogre::Vector3(0.0f, 0.0f, markerHeight);
+	Ogre::Billboard* b = mUnitBillboardSets[scale]->createBillboard(pos, mTeamColors[m.getSide()]);
+	b->setTexcoordIndex(getUnitIcon(m));
+	growMarkerBounds(pos);
+	return b;
+}
+
+// Units may leave the map, in which case the bounds of the marker sets
+// are grown to keep their markers from being culled.
+void App::growMarkerBounds(const Ogre::Vector3& pos)
+{
+	float size = getMarkerSize(markerSizes[NUM_MARKER_SCALES - 1]);
+	Ogre::Vector3 extent(size, size, 0.0f);
+	if(!mMarkerBounds.contains(pos - extent) || !mMarkerBounds.contains(pos + extent)) {
+		Ogre::AxisAlignedBox box = mMarkerBounds;
+		box.merge(pos - extent);
+		box.merge(pos + extent);
+		setMarkerBounds(box);
 	}
-	ent->setMaterialName(materialname);
 }
 
-Ogre::Entity* App::createUnitNode(const MilitaryUnit& m)
+void App::removeUnitMarker(const MilitaryUnit& m, Ogre::Billboard* b)
 {
-	std::ostringstream ss;
-	const std::string unitsize(unitSizeToName(m.getUnitSize()));
-	ss << unitsize << m.getEntityID();
-	Ogre::Entity* unitEnt = mScene->createEntity(ss.str(), "UnitMesh");
-	updateUnitMaterial(m, unitEnt);
-	return unitEnt;
+	mUnitBillboardSets[getMarkerScale(m.getUnitSize())]->removeBillboard(b);
 }
 
 bool App::humanControlled(const MilitaryUnit* m) const
 {
-	return std::find_if(mControlledUnits.begin(), mControlledUnits.end(),
-			[=](const std::pair<MilitaryUnit*, std::shared_ptr<GUIController>>& m1) { return m1.first == m; })
-		!= mControlledUnits.end();
+	return mHumanUnits.find(m) != mHumanUnits.end();
 }
 
 bool App::unitSelected(const MilitaryUnit* m) const
 {
-	return std::find_if(mSelectedUnits.begin(), mSelectedUnits.end(),
-			[=](const std::pair<MilitaryUnit*, Ogre::Entity*>& m1) { return m1.first == m; })
-		!= mSelectedUnits.end();
+	return mSelectedUnits.find(const_cast<MilitaryUnit*>(m)) != mSelectedUnits.end();
 }
 
-std::string App::getUnitMaterialName(const MilitaryUnit& m) const
+size_t App::getUnitIcon(const MilitaryUnit& m) const
 {
-	const std::string unitsize(unitSizeToName(m.getUnitSize()));
-	const std::string unittype(branchToName(m.getBranch()));
-	std::ostringstream ss;
-	std::ostringstream materialstr;
-	ss << unitsize << m.getEntityID();
-	materialstr << unittype << unitsize << m.getSide() << (humanControlled(&m) ? "Human" : "") << (unitSelected(&m) ? "Selected" : "");
-	return materialstr.str();
+	return getIconIndex(m.getBranch(), getMarkerScale(m.getUnitSize()),
+			humanControlled(&m), unitSelected(&m));
 }
 
-void App::updateUnitPosition(const MilitaryUnit* m, Vector2 pos)
+// Builds the marker tables from the unit hierarchy, which doesn't
+// change. The formations are ordered companies first so that they can
+// be updated bottom up.
+void App::createMarkerTables()
 {
-	const MilitaryUnit* lower = m;
-	const MilitaryUnit* comm;
-	while(1) {
-		comm = lower->getCommandingUnit();
-		if(!comm)
-			break;
-		std::map<const MilitaryUnit*, UnitDrawInfo>* unitmap = nullptr;
-		switch(comm->getUnitSize()) {
-			case UnitSize::Company:
-				unitmap = &mCompanyEntities;
-				break;
-			case UnitSize::Battalion:
-				unitmap = &mBattalionEntities;
-				break;
-			case UnitSize::Brigade:
-				unitmap = &mBrigadeEntities;
-				break;
-			default:
-				break;
+	const std::vector<Platoon*>& platoons = Papaya::instance().getPlatoons();
+	std::vector<const MilitaryUnit*> formations[NUM_MARKER_SCALES];
+	std::set<const MilitaryUnit*> found;
+	for(size_t i = 0; i < platoons.size(); i++) {
+		mPlatoonIndices[platoons[i]] = i;
+		for(const MilitaryUnit* comm = platoons[i]->getCommandingUnit();
+				comm && getMarkerScale(comm->getUnitSize()) > 0 && found.insert(comm).second;
+				comm = comm->getCommandingUnit()) {
+			formations[getMarkerScale(comm->getUnitSize())].push_back(comm);
+		}
+	}
+	for(int i = 0; i < NUM_MARKER_SCALES; i++) {
+		for(auto f : formations[i]) {
+			mFormationIndices[f] = mFormationMarkers.size();
+			mFormationMarkers.push_back(FormationMarker(f));
 		}
-		if(unitmap) {
-			auto commit = unitmap->find(comm);
-			if(commit == unitmap->end()) {
-				Ogre::SceneNode* newnode = mRootNode->createChildSceneNode();
-				newnode->attachObject(createUnitNode(*comm));
-				setUnitNodeScale(newnode, *comm);
-				commit = unitmap->insert(unitmap->begin(),
-						std::make_pair(comm, UnitDrawInfo(newnode)));
+	}
+
+	std::vector<std::vector<size_t>> subplatoons(mFormationMarkers.size());
+	std::vector<std::vector<size_t>> subunits(mFormationMarkers.size());
+	mPlatoonMarkers.resize(platoons.size());
+	for(size_t i = 0; i < platoons.size(); i++) {
+		auto it = mFormationIndices.find(platoons[i]->getCommandingUnit());
+		if(it != mFormationIndices.end()) {
+			mPlatoonMarkers[i].mFormation = it->second;
+			subplatoons[it->second].push_back(i);
+		}
+		else {
+			mTopPlatoons.push_back(i);
+		}
+	}
+	for(size_t i = 0; i < mFormationMarkers.size(); i++) {
+		auto it = mFormationIndices.find(mFormationMarkers[i].mUnit->getCommandingUnit());
+		if(it == mFormationIndices.end()) {
+			mTopFormations.push_back(i);
+		}
+		else {
+			mFormationMarkers[i].mParent = it->second;
+			subunits[it->second].push_back(i);
+		}
+	}
+	for(size_t i = 0; i < mFormationMarkers.size(); i++) {
+		FormationMarker& f = mFormationMarkers[i];
+		f.mFirstPlatoon = mFormationPlatoons.size();
+		f.mNumPlatoons = subplatoons[i].size();
+		mFormationPlatoons.insert(mFormationPlatoons.end(), subplatoons[i].begin(), subplatoons[i].end());
+		f.mFirstSubunit = mFormationSubunits.size();
+		f.mNumSubunits = subunits[i].size();
+		mFormationSubunits.insert(mFormationSubunits.end(), subunits[i].begin(), subunits[i].end());
+	}
+
+	// the platoon markers are in the first grid, the formations of
+	// each size in the others
+	for(int i = 0; i < NUM_MARKER_SCALES; i++) {
+		mMarkerGrids.push_back(MarkerGrid(mTerrain.getWidth(), markerGridCells,
+					i == 0 ? mPlatoonMarkers.size() : mFormationMarkers.size()));
+	}
+}
+
+// Called once per frame. Moves the platoon markers to their positions
+// interpolated between the last two simulation frames, marks the
+// formations of the changed platoons for updating and then chooses the
+// markers to draw.
+void App::updateUnits()
+{
+	float alpha = mSimulation.getFrames(mPreviousFrame, mCurrentFrame);
+	const std::vector<Platoon*>& platoons = Papaya::instance().getPlatoons();
+	size_t num = std::min(mCurrentFrame.mPlatoons.size(), mPlatoonMarkers.size());
+	for(size_t i = 0; i < num; i++) {
+		const PlatoonFrame& cur = mCurrentFrame.mPlatoons[i];
+		PlatoonMarker& pm = mPlatoonMarkers[i];
+		if(!cur.mAlive) {
+			if(!pm.mAlive)
+				continue;
+			pm.mAlive = false;
+			showPlatoonMarker(i, false);
+			mSelectedUnits.erase(platoons[i]);
+		}
+		else {
+			Vector2 pos = cur.mPosition;
+			float height = cur.mGroundHeight;
+			if(i < mPreviousFrame.mPlatoons.size() && mPreviousFrame.mPlatoons[i].mAlive) {
+				const PlatoonFrame& prev = mPreviousFrame.mPlatoons[i];
+				pos = prev.mPosition + (cur.mPosition - prev.mPosition) * alpha;
+				height = prev.mGroundHeight + (cur.mGroundHeight - prev.mGroundHeight) * alpha;
 			}
-			if(pos.x || pos.y) {
-				commit->second.mPositions[lower->getEntityID()] = pos;
+			if(pm.mAlive && pm.mPosition.x == pos.x && pm.mPosition.y == pos.y)
+				continue;
+			pm.mAlive = true;
+			pm.mPosition = pos;
+			pm.mGroundHeight = height;
+			if(pm.mBillboard) {
+				pm.mBillboard->setPosition(pos.x, pos.y, height + markerHeight);
+				growMarkerBounds(pm.mBillboard->getPosition());
+				mMarkerGrids[0].moveMarker(i, pos);
 			}
-			else {
-				commit->second.mPositions.erase(lower->getEntityID());
+		}
+		if(pm.mFormation != -1)
+			mFormationMarkers[pm.mFormation].mDirty = true;
+	}
+	updateFormations();
+	updateMarkerLevels();
+}
+
+// Recomputes the positions of the formations with changed subunits in
+// one pass from the lowest formations up.
+void App::updateFormations()
+{
+	for(size_t fi = 0; fi < mFormationMarkers.size(); fi++) {
+		FormationMarker& f = mFormationMarkers[fi];
+		if(!f.mDirty)
+			continue;
+		f.mDirty = false;
+		Vector2 pos;
+		unsigned int num = 0;
+		for(size_t i = f.mFirstPlatoon; i < f.mFirstPlatoon + f.mNumPlatoons; i++) {
+			const PlatoonMarker& pm = mPlatoonMarkers[mFormationPlatoons[i]];
+			if(pm.mAlive) {
+				pos += pm.mPosition;
+				num++;
 			}
-			pos = commit->second.getPosition();
-			lower = comm;
-			if(pos.x || pos.y) {
-				commit->second.mNode->setPosition(pos.x, pos.y, 0.1f);
+		}
+		for(size_t i = f.mFirstSubunit; i < f.mFirstSubunit + f.mNumSubunits; i++) {
+			const FormationMarker& sub = mFormationMarkers[mFormationSubunits[i]];
+			if(sub.mAlive) {
+				pos += sub.mPosition;
+				num++;
 			}
-			else {
-				// All lower units are gone.
-				commit->second.mNode->setVisible(false);
-				unitmap->erase(commit);
+		}
+		if(num) {
+			pos *= 1.0f / num;
+			if(f.mAlive && f.mPosition.x == pos.x && f.mPosition.y == pos.y)
+				continue;
+			f.mAlive = true;
+			f.mPosition = pos;
+			f.mGroundHeight = mTerrainRenderer->getGroundHeight(pos);
+			if(f.mBillboard) {
+				f.mBillboard->setPosition(pos.x, pos.y, f.mGroundHeight + markerHeight);
+				growMarkerBounds(f.mBillboard->getPosition());
+				mMarkerGrids[getMarkerScale(f.mUnit->getUnitSize())].moveMarker(fi, pos);
 			}
 		}
+		else if(f.mAlive) {
+			// all subunits are gone
+			f.mAlive = false;
+			showFormationMarker(fi, false);
+		}
 		else {
-			break;
+			continue;
 		}
+		if(f.mParent != -1)
+			mFormationMarkers[f.mParent].mDirty = true;
 	}
 }
 
-void App::PlatoonStatusChanged(const Platoon* p)
+// Chooses the markers to draw. In the automatic mode a formation is
+// drawn as its subunits when it is close to the camera and its subunits
+// are spread out enough not to cover each other, so the far away parts
+// of the map show fewer and larger markers. Otherwise the units of the
+// chosen size are drawn. Only the markers that appear or disappear are
+// touched.
+void App::updateMarkerLevels()
 {
-	const auto& it = mPlatoonEntities.find(p);
-	Ogre::SceneNode* unitNode;
-	if(it == mPlatoonEntities.end()) {
-		unitNode = mRootNode->createChildSceneNode();
-		unitNode->attachObject(createUnitNode(*p));
-		setUnitNodeScale(unitNode, *p);
-		mPlatoonEntities.insert(std::make_pair(p, UnitDrawInfo(unitNode)));
-	}
-	else {
-		unitNode = it->second.mNode;
+	Ogre::Vector3 campos = mCamera->getDerivedPosition();
+	for(auto i : mTopPlatoons)
+		showPlatoonMarker(i, mAutoUnitScale || mUnitScale == UnitSize::Platoon);
+	for(auto i : mTopFormations)
+		updateFormationLevel(i, true, campos);
+}
+
+// Shows either the marker of the formation or its subunits, which are
+// updated recursively, or neither if the formation is not visible.
+void App::updateFormationLevel(size_t fi, bool visible, const Ogre::Vector3& campos)
+{
+	FormationMarker& f = mFormationMarkers[fi];
+	bool split = visible && f.mAlive && splitFormation(fi, campos);
+	showFormationMarker(fi, visible && !split);
+	if(!split && !f.mExpanded) {
+		// the subunits are hidden already
+		return;
 	}
-	if(!p->isDead()) {
-		unitNode->setPosition(p->getPosition().x, p->getPosition().y, 0.1f);
-		updateUnitPosition(p, p->getPosition());
+	f.mExpanded = split;
+	for(size_t i = f.mFirstPlatoon; i < f.mFirstPlatoon + f.mNumPlatoons; i++)
+		showPlatoonMarker(mFormationPlatoons[i], split);
+	for(size_t i = f.mFirstSubunit; i < f.mFirstSubunit + f.mNumSubunits; i++)
+		updateFormationLevel(mFormationSubunits[i], split, campos);
+}
+
+bool App::splitFormation(size_t fi, const Ogre::Vector3& campos) const
+{
+	const FormationMarker& f = mFormationMarkers[fi];
+	int scale = getMarkerScale(f.mUnit->getUnitSize());
+	if(!mAutoUnitScale)
+		return scale > getMarkerScale(mUnitScale);
+
+	Ogre::Vector3 pos(f.mPosition.x, f.mPosition.y, f.mGroundHeight);
+	if(pos.distance(campos) > markerLodDistance * (1 << (scale - 1)))
+		return false;
+
+	float spread = 0.0f;
+	for(size_t i = f.mFirstPlatoon; i < f.mFirstPlatoon + f.mNumPlatoons; i++) {
+		const PlatoonMarker& pm = mPlatoonMarkers[mFormationPlatoons[i]];
+		if(pm.mAlive)
+			spread = std::max(spread, (pm.mPosition - f.mPosition).length());
 	}
-	else {
-		unitNode->setVisible(false);
-		mRootNode->removeChild(unitNode);
-		mPlatoonEntities.erase(it);
-		updateUnitPosition(p, Vector2());
+	for(size_t i = f.mFirstSubunit; i < f.mFirstSubunit + f.mNumSubunits; i++) {
+		const FormationMarker& sub = mFormationMarkers[mFormationSubunits[i]];
+		if(sub.mAlive)
+			spread = std::max(spread, (sub.mPosition - f.mPosition).length());
 	}
+	return spread > getMarkerSize(markerSizes[scale - 1]);
 }
 
-void App::setUnitNodeScale(Ogre::SceneNode* n, const MilitaryUnit& m)
+// Creates or removes the billboard of a living platoon as needed.
+void App::showPlatoonMarker(size_t i, bool shown)
 {
-	float scale = 1.0f;
-	switch(m.getUnitSize()) {
-		case UnitSize::Single: scale = 0.1f; break;
-		case UnitSize::Squad: scale = 0.5f; break;
-		case UnitSize::Platoon: scale = 1.0f; break;
-		case UnitSize::Company: scale = 2.0f; break;
-		case UnitSize::Battalion: scale = 4.0f; break;
-		case UnitSize::Brigade: scale = 8.0f; break;
-		case UnitSize::Division: scale = 16.0f; break;
+	PlatoonMarker& pm = mPlatoonMarkers[i];
+	shown = shown && pm.mAlive;
+	if(shown == (pm.mBillboard != nullptr))
+		return;
+	const Platoon& p = *Papaya::instance().getPlatoons()[i];
+	if(shown) {
+		pm.mBillboard = createUnitMarker(p, Ogre::Vector3(pm.mPosition.x, pm.mPosition.y, pm.mGroundHeight));
+		mMarkerGrids[0].addMarker(i, pm.mPosition);
+	}
+	else {
+		removeUnitMarker(p, pm.mBillboard);
+		pm.mBillboard = nullptr;
+		mMarkerGrids[0].removeMarker(i);
 	}
-	n->setScale(scale, scale, 1.0f);
 }
 
-void App::createLine(const std::string& name, const std::vector<Vector2>& points)
+void App::showFormationMarker(size_t fi, bool shown)
 {
-	Ogre::SceneNode* node;
-	Ogre::ManualObject* obj;
-	bool newobject = false;
-
-	if(!mScene->hasSceneNode(name)) {
-		node = mScene->getRootSceneNode()->createChildSceneNode(name); 
-		newobject = true;
+	FormationMarker& f = mFormationMarkers[fi];
+	shown = shown && f.mAlive;
+	if(shown == (f.mBillboard != nullptr))
+		return;
+	MarkerGrid& grid = mMarkerGrids[getMarkerScale(f.mUnit->getUnitSize())];
+	if(shown) {
+		f.mBillboard = createUnitMarker(*f.mUnit, Ogre::Vector3(f.mPosition.x, f.mPosition.y, f.mGroundHeight));
+		grid.addMarker(fi, f.mPosition);
 	}
 	else {
-		node = mScene->getSceneNode(name); 
+		removeUnitMarker(*f.mUnit, f.mBillboard);
+		f.mBillboard = nullptr;
+		grid.removeMarker(fi);
 	}
-	if(newobject) {
-		obj = mScene->createManualObject(name);
-		obj->begin("LineMaterial", Ogre::RenderOperation::OT_LINE_STRIP); 
+}
+
+// The point on the ground the platoon is drawn at when its marker is
+// shown. Returns false if it is dead.
+bool App::getPlatoonPosition(const MilitaryUnit* m, Ogre::Vector3& pos) const
+{
+	auto it = mPlatoonIndices.find(m);
+	if(it == mPlatoonIndices.end() || !mPlatoonMarkers[it->second].mAlive)
+		return false;
+	const PlatoonMarker& pm = mPlatoonMarkers[it->second];
+	pos = Ogre::Vector3(pm.mPosition.x, pm.mPosition.y, pm.mGroundHeight);
+	return true;
+}
+
+void App::setTargetArea(const Area2& area)
+{
+	Vector2 points[4] = { Vector2(area.x1, area.y1), Vector2(area.x1, area.y2),
+		Vector2(area.x2, area.y2), Vector2(area.x2, area.y1) };
+	Ogre::Vector3 corners[4];
+	for(int i = 0; i < 4; i++)
+		corners[i] = Ogre::Vector3(points[i].x, points[i].y,
+				mTerrainRenderer->getGroundHeight(points[i]));
+	for(int i = 0; i < 4; i++) {
+		if(mTargetAreaSegments.size() < 4)
+			mTargetAreaSegments.push_back(mLines->addSegment(corners[i], corners[(i + 1) % 4]));
+		else
+			mLines->setSegment(mTargetAreaSegments[i], corners[i], corners[(i + 1) % 4]);
 	}
-	else {
-		obj = mScene->getManualObject(name);
-		obj->beginUpdate(0);
+}
+
+// Selecting a formation also selects its platoons, which take the
+// orders.
+void App::setSelectedUnit(MilitaryUnit* m)
+{
+	auto prevsel = mSelectedUnits;
+	mSelectedUnits.clear();
+	for(auto u : prevsel) {
+		updateUnitIcon(*u);
 	}
-	for(auto& p : points) {
-		obj->position(p.x, p.y, lineHeight);
+	mSelectedUnits.insert(m);
+	auto it = mFormationIndices.find(m);
+	if(it != mFormationIndices.end())
+		selectPlatoons(it->second);
+	for(auto u : mSelectedUnits) {
+		updateUnitIcon(*u);
 	}
-	obj->end(); 
-	if(newobject)
-		node->attachObject(obj);
 }
 
-void App::deleteLine(const std::string& name)
+void App::selectPlatoons(size_t formation)
 {
-	if(mScene->hasSceneNode(name)) {
-		Ogre::SceneNode* node = mScene->getSceneNode(name);
-		Ogre::ManualObject* obj = mScene->getManualObject(name);
-		node->detachObject(obj);
-		mScene->destroyManualObject(obj);
-		mScene->destroySceneNode(node);
+	const std::vector<Platoon*>& platoons = Papaya::instance().getPlatoons();
+	const FormationMarker& f = mFormationMarkers[formation];
+	for(size_t i = f.mFirstPlatoon; i < f.mFirstPlatoon + f.mNumPlatoons; i++) {
+		if(mPlatoonMarkers[mFormationPlatoons[i]].mAlive)
+			mSelectedUnits.insert(platoons[mFormationPlatoons[i]]);
 	}
+	for(size_t i = f.mFirstSubunit; i < f.mFirstSubunit + f.mNumSubunits; i++)
+		selectPlatoons(mFormationSubunits[i]);
 }
 
-void App::setTargetArea(const Area2& area)
+// The unit whose shown marker is under the point, the closest one if the
+// markers overlap.
+MilitaryUnit* App::pickUnit(const Vector2& point) const
 {
-	std::vector<Vector2> points;
-	points.push_back(Vector2(area.x1, area.y1));
-	points.push_back(Vector2(area.x1, area.y2));
-	points.push_back(Vector2(area.x2, area.y2));
-	points.push_back(Vector2(area.x2, area.y1));
-	points.push_back(Vector2(area.x1, area.y1));
-	createLine("Target Area Line", points);
-}
-
-void App::setSelectedUnit(Ogre::Entity* e)
-{
-	int entityid;
-	if(sscanf(e->getName().c_str(), "Platoon%d", &entityid) == 1) {
-		Entity* en = EntityManager::instance().getEntity(entityid);
-		if(en) {
-			Platoon* p = dynamic_cast<Platoon*>(en);
-			if(p) {
-				auto prevsel = mSelectedUnits;
-				mSelectedUnits.clear();
-				for(auto& m : prevsel) {
-					updateUnitMaterial(*m.first, m.second);
-				}
-				mSelectedUnits.push_back(std::pair<MilitaryUnit*, Ogre::Entity*>(p, e));
-				updateUnitMaterial(*p, e);
-			}
+	MilitaryUnit* nearest = nullptr;
+	float nearestdist = 0.0f;
+	for(int scale = 0; scale < NUM_MARKER_SCALES; scale++) {
+		int id = mMarkerGrids[scale].findNearest(point, getMarkerSize(markerSizes[scale]) * 0.5f);
+		if(id == -1)
+			continue;
+		MilitaryUnit* m;
+		Vector2 pos;
+		if(scale == 0) {
+			m = Papaya::instance().getPlatoons()[id];
+			pos = mPlatoonMarkers[id].mPosition;
+		}
+		else {
+			m = const_cast<MilitaryUnit*>(mFormationMarkers[id].mUnit);
+			pos = mFormationMarkers[id].mPosition;
+		}
+		float dist = (pos - point).length();
+		if(!nearest || dist < nearestdist) {
+			nearest = m;
+			nearestdist = dist;
 		}
 	}
+	return nearest;
 }
 
 void App::focusOnControlledUnit(size_t index)
 {
 	size_t i = 0;
 	for(auto it = mControlledUnits.begin(); it != mControlledUnits.end(); ++it, i++) {
-		if(i == index && !it->first->isDead()) {
-			mCamNode->setPosition(it->first->getPosition().x, it->first->getPosition().y,
-					mCamNode->getPosition().z);
+		Ogre::Vector3 pos;
+		if(i == index && getPlatoonPosition(it->first, pos)) {
+			mCamNode->setPosition(pos.x, pos.y, mCamNode->getPosition().z);
 			return;
 		}
 	}
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <memory>
+#include <set>
 
 #include <Ogre.h>
 #include <OIS.h>
@@ -11,63 +12,107 @@
 #include "Papaya.h"
 #include "Messaging.h"
 #include "Clock.h"
+#include "SimulationThread.h"
+#include "OrderLineBatch.h"
+#include "TerrainRenderer.h"
+#include "MarkerGrid.h"
 
 class GUIController;
 
-class App : public OIS::KeyListener, public OIS::MouseListener, public PapayaEventListener, public WorldEntity {
+// platoon, company, battalion and brigade markers
+#define NUM_MARKER_SCALES 4
+
+// The simulation runs on its own thread; the app only reads the unit
+// hierarchy, which doesn't change, and gets the platoon positions from
+// the simulation frames.
+class App : public OIS::KeyListener, public OIS::MouseListener {
 	public:
 		App();
 		~App();
 		void run();
 		bool keyPressed(const OIS::KeyEvent &arg);
 		bool keyReleased(const OIS::KeyEvent &arg);
-		void PlatoonStatusChanged(const Platoon* p);
-		void receiveMessage(const Message& m);
 		bool mouseMoved(const OIS::MouseEvent& arg);
 		bool mousePressed(const OIS::MouseEvent& arg, OIS::MouseButtonID button);
 		bool mouseReleased(const OIS::MouseEvent& arg, OIS::MouseButtonID button);
 		void setTargetArea(const Area2& area);
+		EntityID getHumanUnit() const;
+		SimulationThread& getSimulation();
 	private:
 		void initResources();
 		void initInput();
-		void createUnitMesh();
+		void createUnitMarkers();
+		void createUnitIconAtlas(std::vector<Ogre::FloatRect>& coords);
 		void createExtraMaterials();
 		void createTerrain();
 		void createTerrainTextures();
 		void updateTerrain();
-		void createTexture(const std::string& name, size_t width, size_t height,
-				std::function<std::tuple<Ogre::uint8, Ogre::uint8, Ogre::uint8> (size_t, size_t)> func);
-		void setupUnitDisplay();
-		Ogre::Entity* createUnitNode(const MilitaryUnit& m);
-		void updateUnitPosition(const MilitaryUnit* m, Vector2 pos);
-		void setUnitNodeScale(Ogre::SceneNode* n, const MilitaryUnit& m);
+		void createMarkerTables();
+		void updateUnits();
+		void updateFormations();
+		void updateMarkerLevels();
+		void updateFormationLevel(size_t fi, bool visible, const Ogre::Vector3& campos);
+		bool splitFormation(size_t fi, const Ogre::Vector3& campos) const;
+		void showPlatoonMarker(size_t i, bool shown);
+		void showFormationMarker(size_t fi, bool shown);
+		bool getPlatoonPosition(const MilitaryUnit* m, Ogre::Vector3& pos) const;
+		Ogre::Billboard* getUnitMarker(const MilitaryUnit* m) const;
+		Ogre::Billboard* createUnitMarker(const MilitaryUnit& m, const Ogre::Vector3& ground);
+		void removeUnitMarker(const MilitaryUnit& m, Ogre::Billboard* b);
+		void growMarkerBounds(const Ogre::Vector3& pos);
+		void setMarkerBounds(const Ogre::AxisAlignedBox& box);
 		bool checkWindowResize();
-		std::string getUnitMaterialName(const MilitaryUnit& m) const;
+		size_t getUnitIcon(const MilitaryUnit& m) const;
 		bool humanControlled(const MilitaryUnit* m) const;
 		bool unitSelected(const MilitaryUnit* m) const;
 		void setupHumanControls();
-		void setSelectedUnit(Ogre::Entity* e);
-		void updateUnitMaterial(const MilitaryUnit& m, Ogre::Entity* ent);
-		void createLine(const std::string& name, const std::vector<Vector2>& points);
-		void deleteLine(const std::string& name);
+		void setSelectedUnit(MilitaryUnit* m);
+		void selectPlatoons(size_t formation);
+		MilitaryUnit* pickUnit(const Vector2& point) const;
+		void updateUnitIcon(const MilitaryUnit& m);
 		void updateCommandLines();
 		void focusOnControlledUnit(size_t index);
 
-		struct UnitDrawInfo {
-			UnitDrawInfo(Ogre::SceneNode* node)
-				: mNode(node) { }
-			std::map<EntityID, Vector2> mPositions;
-			Ogre::SceneNode *mNode;
-			Vector2 getPosition() const
-			{
-				Vector2 p;
-				for(auto& it : mPositions) {
-					p += it.second;
-				}
-				if(mPositions.size())
-					p *= (1.0f / mPositions.size());
-				return p;
-			}
+		// The markers of the platoons, in the order of
+		// Papaya::getPlatoons(), and of the formations above them.
+		// A marker is a billboard in the set of its scale, or null
+		// if the unit is not drawn, either because it is dead or
+		// because the marker level of detail hides it.
+		struct PlatoonMarker {
+			PlatoonMarker()
+				: mBillboard(nullptr), mGroundHeight(0.0f), mFormation(-1),
+				mAlive(false) { }
+			Ogre::Billboard* mBillboard;
+			Vector2 mPosition;
+			// from the simulation frames
+			float mGroundHeight;
+			int mFormation;
+			bool mAlive;
+		};
+
+		// A formation is at the average position of its living
+		// subunits, which are indices to mFormationPlatoons and
+		// mFormationSubunits. It is expanded when its subunits are
+		// drawn instead of it.
+		struct FormationMarker {
+			FormationMarker(const MilitaryUnit* m)
+				: mUnit(m), mBillboard(nullptr), mParent(-1),
+				mFirstPlatoon(0), mNumPlatoons(0),
+				mFirstSubunit(0), mNumSubunits(0), mDirty(false),
+				mAlive(false), mExpanded(false), mGroundHeight(0.0f) { }
+			const MilitaryUnit* mUnit;
+			Ogre::Billboard* mBillboard;
+			Vector2 mPosition;
+			int mParent;
+			size_t mFirstPlatoon;
+			size_t mNumPlatoons;
+			size_t mFirstSubunit;
+			size_t mNumSubunits;
+			bool mDirty;
+			bool mAlive;
+			bool mExpanded;
+			// looked up when the formation moves, not every frame
+			float mGroundHeight;
 		};
 
 		std::unique_ptr<Ogre::Root> mRoot;
@@ -77,8 +122,6 @@ class App : public OIS::KeyListener, public OIS::MouseListener, public PapayaEve
 		Ogre::Camera* mCamera;
 		Ogre::SceneNode* mCamNode;
 		Ogre::Viewport* mViewport;
-		Ogre::RaySceneQuery* mRaySceneQuery;
-		Ogre::Plane mTerrainPlane;
 
 		OIS::InputManager* mInputManager;
 		OIS::Keyboard* mKeyboard;
@@ -86,28 +129,48 @@ class App : public OIS::KeyListener, public OIS::MouseListener, public PapayaEve
 
 		std::string mUserDataDir;
 		Terrain mTerrain;
+		std::unique_ptr<TerrainRenderer> mTerrainRenderer;
 		bool mRunning;
 		float mUpVelocity;
 		float mRightVelocity;
 		float mForwardVelocity;
 		int mMapRenderType;
-		std::map<const Platoon*, UnitDrawInfo> mPlatoonEntities;
-		std::map<const MilitaryUnit*, UnitDrawInfo> mCompanyEntities;
-		std::map<const MilitaryUnit*, UnitDrawInfo> mBattalionEntities;
-		std::map<const MilitaryUnit*, UnitDrawInfo> mBrigadeEntities;
+		std::vector<PlatoonMarker> mPlatoonMarkers;
+		std::vector<FormationMarker> mFormationMarkers;
+		std::vector<size_t> mFormationPlatoons;
+		std::vector<size_t> mFormationSubunits;
+		// the platoons and formations not under any formation marker
+		std::vector<size_t> mTopPlatoons;
+		std::vector<size_t> mTopFormations;
+		std::map<const MilitaryUnit*, size_t> mPlatoonIndices;
+		std::map<const MilitaryUnit*, size_t> mFormationIndices;
+		Ogre::BillboardSet* mUnitBillboardSets[NUM_MARKER_SCALES];
+		// covers all markers of all sets
+		Ogre::AxisAlignedBox mMarkerBounds;
+		std::vector<MarkerGrid> mMarkerGrids;
 		std::map<int, Ogre::ColourValue> mTeamColors;
 		UnitSize mUnitScale;
-		bool mUnitScaleChanged;
+		bool mAutoUnitScale;
 		unsigned int mWindowWidth;
 		unsigned int mWindowHeight;
 		Vector2 mLineEnd;
 		unsigned int mTimeScale;
 		std::list<std::pair<MilitaryUnit*, std::shared_ptr<GUIController>>> mControlledUnits;
-		std::list<std::pair<MilitaryUnit*, Ogre::Entity*>> mSelectedUnits;
+		std::set<const MilitaryUnit*> mHumanUnits;
+		std::set<MilitaryUnit*> mSelectedUnits;
 		std::shared_ptr<MilitaryUnit> mOwnUnit;
 		bool mObserver;
-		std::map<MilitaryUnit*, Vector2> mOrderLines;
+		struct OrderLine {
+			Ogre::Vector3 mTarget;
+			size_t mSegment;
+		};
+		std::unique_ptr<OrderLineBatch> mLines;
+		std::map<MilitaryUnit*, OrderLine> mOrderLines;
+		std::vector<size_t> mTargetAreaSegments;
 		Clock mClock;
+		SimulationThread mSimulation;
+		SimulationFrame mPreviousFrame;
+		SimulationFrame mCurrentFrame;
 };
 
 #endif
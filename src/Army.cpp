@@ -12,14 +12,26 @@ Army::Army(const Terrain& t, const Vector2& base, int side,
 	mUnits.push_back(std::unique_ptr<Brigade>(new Brigade(this, mBase, ServiceBranch::Infantry, mSide, armyConfiguration)));
 }
 
-std::list<Platoon*> Army::update(float dt)
+void Army::update(float dt, std::vector<Platoon*>& changed)
 {
 	if(!mSentAttackMessage) {
 		MessageDispatcher::instance().dispatchMessage(Message(mEntityID, mUnits[0]->getEntityID(),
 					0.0f, 0.0f, MessageType::ClaimArea, MessageData(Area2(0, 0, mTerrain.getWidth(), mTerrain.getWidth()))));
 		mSentAttackMessage = true;
 	}
-	return MilitaryUnit::update(dt);
+	// the platoons themselves are updated by the activity scheduler in Papaya.
+}
+
+void Army::saveState(CheckpointWriter& w) const
+{
+	MilitaryUnit::saveState(w);
+	w.write(mSentAttackMessage);
+}
+
+void Army::loadState(CheckpointReader& r)
+{
+	MilitaryUnit::loadState(r);
+	mSentAttackMessage = r.read<bool>();
 }
 
 const char* branchToName(ServiceBranch b)
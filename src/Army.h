@@ -1,7 +1,6 @@
 #ifndef ARMY_H
 #define ARMY_H
 
-#include <list>
 #include <vector>
 
 #include "Messaging.h"
@@ -14,7 +13,9 @@ class Army : public MilitaryUnit {
 		Army(const Terrain& t, const Vector2& base, int side,
 				const std::vector<ServiceBranch>& armyConfiguration);
 		UnitSize getUnitSize() const;
-		virtual std::list<Platoon*> update(float dt);
+		virtual void update(float dt, std::vector<Platoon*>& changed);
+		void saveState(CheckpointWriter& w) const;
+		void loadState(CheckpointReader& r);
 	private:
 		const Terrain& mTerrain;
 		Vector2 mBase;
@@ -0,0 +1,57 @@
+#include <limits>
+
+#include "Assignment.h"
+
+std::vector<int> solveAssignment(const std::vector<float>& costs, int n)
+{
+	// potentials and matching are 1-based; index 0 is a dummy worker
+	// used while augmenting
+	const float inf = std::numeric_limits<float>::max();
+	std::vector<float> u(n + 1), v(n + 1);
+	std::vector<int> taskWorker(n + 1), way(n + 1);
+	for(int i = 1; i <= n; i++) {
+		taskWorker[0] = i;
+		int j0 = 0;
+		std::vector<float> minv(n + 1, inf);
+		std::vector<bool> used(n + 1, false);
+		do {
+			used[j0] = true;
+			int i0 = taskWorker[j0];
+			float delta = inf;
+			int j1 = 0;
+			for(int j = 1; j <= n; j++) {
+				if(used[j])
+					continue;
+				float cur = costs[(i0 - 1) * n + (j - 1)] - u[i0] - v[j];
+				if(cur < minv[j]) {
+					minv[j] = cur;
+					way[j] = j0;
+				}
+				if(minv[j] < delta) {
+					delta = minv[j];
+					j1 = j;
+				}
+			}
+			for(int j = 0; j <= n; j++) {
+				if(used[j]) {
+					u[taskWorker[j]] += delta;
+					v[j] -= delta;
+				}
+				else {
+					minv[j] -= delta;
+				}
+			}
+			j0 = j1;
+		} while(taskWorker[j0] != 0);
+		do {
+			int j1 = way[j0];
+			taskWorker[j0] = taskWorker[j1];
+			j0 = j1;
+		} while(j0);
+	}
+	std::vector<int> workerTask(n);
+	for(int j = 1; j <= n; j++)
+		workerTask[taskWorker[j] - 1] = j - 1;
+	return workerTask;
+}
+
@@ -0,0 +1,12 @@
+#ifndef ASSIGNMENT_H
+#define ASSIGNMENT_H
+
+#include <vector>
+
+// Assigns each of n workers a distinct task so that the total cost is
+// minimised (Hungarian algorithm, O(n^3)). costs is row-major with
+// costs[worker * n + task]. Returns the task of each worker.
+std::vector<int> solveAssignment(const std::vector<float>& costs, int n);
+
+#endif
+
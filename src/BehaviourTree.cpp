@@ -0,0 +1,297 @@
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string.h>
+#include <stdlib.h>
+
+#include "BehaviourTree.h"
+#include "Papaya.h"
+
+namespace {
+
+struct NodeInfo {
+	const char* mName;
+	BehaviourNodeType mType;
+	int mMinChildren;
+	int mMaxChildren;
+	int mArgs;
+};
+
+const NodeInfo nodeInfos[] = {
+	{ "selector", BehaviourNodeType::Selector, 1, 0xffff, 0 },
+	{ "sequence", BehaviourNodeType::Sequence, 1, 0xffff, 0 },
+	{ "not", BehaviourNodeType::Not, 1, 1, 0 },
+	{ "succeed", BehaviourNodeType::Succeed, 0, 0, 0 },
+	{ "fail", BehaviourNodeType::Fail, 0, 0, 0 },
+	{ "message", BehaviourNodeType::IsMessage, 0, 0, 1 },
+	{ "cooldown", BehaviourNodeType::Cooldown, 0, 0, 2 },
+	{ "posture", BehaviourNodeType::HasPosture, 0, 0, 1 },
+	{ "enemy-closer", BehaviourNodeType::EnemyCloser, 0, 0, 0 },
+	{ "move-to-point", BehaviourNodeType::MoveToPoint, 0, 0, 0 },
+	{ "move-to-area", BehaviourNodeType::MoveToArea, 0, 0, 0 },
+	{ "engage", BehaviourNodeType::Engage, 0, 0, 0 },
+	{ "report", BehaviourNodeType::Report, 0, 0, 0 },
+	{ "split-area", BehaviourNodeType::SplitArea, 0, 0, 0 },
+	{ "attack-enemy", BehaviourNodeType::AttackEnemy, 0, 0, 0 },
+};
+
+const char* messageTypeNames[] = { "ClaimArea", "Goto", "EnemyDiscovered",
+	"ReachedPosition", "PlatoonDied", "AttackEnemy" };
+
+const char* postureNames[] = { "Holding", "Moving", "Engaged" };
+
+struct Line {
+	int mNumber;
+	int mIndent;
+	std::vector<std::string> mTokens;
+};
+
+class Compiler {
+	public:
+		Compiler(const std::string& name, std::vector<BehaviourNode>& nodes,
+				std::vector<std::string>& variables)
+			: mName(name), mNodes(nodes), mVariables(variables) { }
+		void compile(const std::string& text);
+	private:
+		size_t compileNode(size_t l);
+		int lookup(const Line& line, const std::string& s, const char** names, int num) const;
+		void error(const Line& line, const std::string& msg) const;
+		std::string mName;
+		std::vector<Line> mLines;
+		std::vector<BehaviourNode>& mNodes;
+		std::vector<std::string>& mVariables;
+};
+
+void Compiler::compile(const std::string& text)
+{
+	std::istringstream in(text);
+	std::string l;
+	int number = 0;
+	while(std::getline(in, l)) {
+		number++;
+		size_t comment = l.find('#');
+		if(comment != std::string::npos)
+			l.erase(comment);
+		Line line;
+		line.mNumber = number;
+		line.mIndent = 0;
+		while(line.mIndent < (int)l.size() && (l[line.mIndent] == '\t' || l[line.mIndent] == ' '))
+			line.mIndent++;
+		std::istringstream tokens(l);
+		std::string t;
+		while(tokens >> t)
+			line.mTokens.push_back(t);
+		if(line.mTokens.empty())
+			continue;
+		if(line.mTokens[0] == "var") {
+			if(line.mTokens.size() != 2 || line.mIndent != 0)
+				error(line, "variables are declared as \"var <name>\" at the top level");
+			mVariables.push_back(line.mTokens[1]);
+			continue;
+		}
+		mLines.push_back(line);
+	}
+	if(mLines.empty())
+		throw std::runtime_error(mName + ": no nodes");
+	size_t next = compileNode(0);
+	if(next != mLines.size())
+		error(mLines[next], "only one root node is allowed");
+}
+
+// Compiles the node on line l and its children, returning the first line
+// after them.
+size_t Compiler::compileNode(size_t l)
+{
+	const Line& line = mLines[l];
+	const NodeInfo* info = nullptr;
+	for(auto& ni : nodeInfos) {
+		if(line.mTokens[0] == ni.mName)
+			info = &ni;
+	}
+	if(!info)
+		error(line, "unknown node \"" + line.mTokens[0] + "\"");
+	if((int)line.mTokens.size() - 1 != info->mArgs)
+		error(line, "wrong number of arguments");
+
+	size_t index = mNodes.size();
+	if(index >= BEHAVIOUR_SUCCESS)
+		error(line, "too many nodes");
+	BehaviourNode n;
+	n.mType = info->mType;
+	n.mEnd = 0;
+	n.mOnSuccess = BEHAVIOUR_SUCCESS;
+	n.mOnFailure = BEHAVIOUR_FAILURE;
+	n.mArg = 0;
+	n.mValue = 0.0f;
+	switch(info->mType) {
+		case BehaviourNodeType::IsMessage:
+			n.mArg = lookup(line, line.mTokens[1], messageTypeNames,
+					sizeof(messageTypeNames) / sizeof(messageTypeNames[0]));
+			break;
+		case BehaviourNodeType::HasPosture:
+			n.mArg = lookup(line, line.mTokens[1], postureNames,
+					sizeof(postureNames) / sizeof(postureNames[0]));
+			break;
+		case BehaviourNodeType::Cooldown:
+			{
+				n.mArg = -1;
+				for(size_t i = 0; i < mVariables.size(); i++) {
+					if(mVariables[i] == line.mTokens[1])
+						n.mArg = i;
+				}
+				if(n.mArg == -1)
+					error(line, "undeclared variable \"" + line.mTokens[1] + "\"");
+				n.mValue = atof(line.mTokens[2].c_str());
+			}
+			break;
+		default:
+			break;
+	}
+	mNodes.push_back(n);
+
+	int children = 0;
+	size_t next = l + 1;
+	int childIndent = -1;
+	while(next < mLines.size() && mLines[next].mIndent > line.mIndent) {
+		if(childIndent == -1)
+			childIndent = mLines[next].mIndent;
+		else if(mLines[next].mIndent != childIndent)
+			error(mLines[next], "inconsistent indentation");
+		next = compileNode(next);
+		children++;
+	}
+	if(children < info->mMinChildren || children > info->mMaxChildren)
+		error(line, "wrong number of children for \"" + line.mTokens[0] + "\"");
+	mNodes[index].mEnd = mNodes.size();
+	return next;
+}
+
+int Compiler::lookup(const Line& line, const std::string& s, const char** names, int num) const
+{
+	for(int i = 0; i < num; i++) {
+		if(s == names[i])
+			return i;
+	}
+	error(line, "unknown value \"" + s + "\"");
+	return -1;
+}
+
+void Compiler::error(const Line& line, const std::string& msg) const
+{
+	std::ostringstream ss;
+	ss << mName << ":" << line.mNumber << ": " << msg;
+	throw std::runtime_error(ss.str());
+}
+
+}
+
+BehaviourTree::BehaviourTree()
+	: mEntry(BEHAVIOUR_FAILURE)
+{
+}
+
+BehaviourTree BehaviourTree::compile(const std::string& text, const std::string& name)
+{
+	BehaviourTree t;
+	Compiler c(name, t.mNodes, t.mVariables);
+	c.compile(text);
+	t.link(0, BEHAVIOUR_SUCCESS, BEHAVIOUR_FAILURE);
+	t.mEntry = t.getEntry(0);
+	return t;
+}
+
+BehaviourTree BehaviourTree::load(const std::string& filename)
+{
+	std::ifstream f(filename.c_str());
+	if(!f.is_open())
+		throw std::runtime_error("Could not open behaviour tree " + filename);
+	std::stringstream ss;
+	ss << f.rdbuf();
+	return compile(ss.str(), filename);
+}
+
+// Returns whether the tree succeeded, i.e. the message was handled.
+bool BehaviourTree::run(BehaviourAgent& agent, const Message& m, float* blackboard) const
+{
+	unsigned int i = mEntry;
+	while(i < BEHAVIOUR_SUCCESS) {
+		const BehaviourNode& n = mNodes[i];
+		bool res;
+		switch(n.mType) {
+			case BehaviourNodeType::Succeed:
+				res = true;
+				break;
+
+			case BehaviourNodeType::Fail:
+				res = false;
+				break;
+
+			case BehaviourNodeType::IsMessage:
+				res = int(m.mType) == n.mArg;
+				break;
+
+			case BehaviourNodeType::Cooldown:
+				{
+					// the variable holds the time the cooldown expires
+					float now = Papaya::instance().getCurrentTime();
+					res = now >= blackboard[n.mArg];
+					if(res)
+						blackboard[n.mArg] = now + n.mValue;
+				}
+				break;
+
+			default:
+				res = agent.runBehaviour(n, m);
+				break;
+		}
+		i = res ? n.mOnSuccess : n.mOnFailure;
+	}
+	return i == BEHAVIOUR_SUCCESS;
+}
+
+size_t BehaviourTree::getNumVariables() const
+{
+	return mVariables.size();
+}
+
+// The first leaf run when entering the subtree at i.
+unsigned int BehaviourTree::getEntry(unsigned int i) const
+{
+	while(mNodes[i].mType == BehaviourNodeType::Selector ||
+			mNodes[i].mType == BehaviourNodeType::Sequence ||
+			mNodes[i].mType == BehaviourNodeType::Not)
+		i++;
+	return i;
+}
+
+// Sets where to continue after each leaf in the subtree at i succeeds or
+// fails, so that the composite nodes are never visited when running.
+void BehaviourTree::link(unsigned int i, unsigned int onSuccess, unsigned int onFailure)
+{
+	BehaviourNode& n = mNodes[i];
+	n.mOnSuccess = onSuccess;
+	n.mOnFailure = onFailure;
+	switch(n.mType) {
+		case BehaviourNodeType::Selector:
+			for(unsigned int c = i + 1; c < n.mEnd; c = mNodes[c].mEnd) {
+				unsigned int next = mNodes[c].mEnd;
+				link(c, onSuccess, next < n.mEnd ? getEntry(next) : onFailure);
+			}
+			break;
+
+		case BehaviourNodeType::Sequence:
+			for(unsigned int c = i + 1; c < n.mEnd; c = mNodes[c].mEnd) {
+				unsigned int next = mNodes[c].mEnd;
+				link(c, next < n.mEnd ? getEntry(next) : onSuccess, onFailure);
+			}
+			break;
+
+		case BehaviourNodeType::Not:
+			link(i + 1, onFailure, onSuccess);
+			break;
+
+		default:
+			break;
+	}
+}
+
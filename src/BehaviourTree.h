@@ -0,0 +1,70 @@
+#ifndef BEHAVIOURTREE_H
+#define BEHAVIOURTREE_H
+
+#include <string>
+#include <vector>
+
+#include "Messaging.h"
+
+enum class BehaviourNodeType : unsigned char {
+	// composites and decorators
+	Selector,
+	Sequence,
+	Not,
+	// leaves run by the tree itself
+	Succeed,
+	Fail,
+	IsMessage,
+	Cooldown,
+	// leaves run by the agent
+	HasPosture,
+	EnemyCloser,
+	MoveToPoint,
+	MoveToArea,
+	Engage,
+	Report,
+	SplitArea,
+	AttackEnemy
+};
+
+#define BEHAVIOUR_SUCCESS 0xfffe
+#define BEHAVIOUR_FAILURE 0xffff
+
+struct BehaviourNode {
+	BehaviourNodeType mType;
+	// index of the node after the last descendant of this node
+	unsigned short mEnd;
+	// indices of the leaves to run next
+	unsigned short mOnSuccess;
+	unsigned short mOnFailure;
+	int mArg;
+	float mValue;
+};
+
+class BehaviourAgent {
+	public:
+		virtual bool runBehaviour(const BehaviourNode& n, const Message& m) = 0;
+};
+
+// A behaviour tree compiled from a text definition into a flat array of
+// nodes in depth-first order. Each leaf is linked to the leaf to run next
+// on success and on failure, so running the tree is a loop over the leaves
+// without recursion. Variables declared with "var" are slots in a
+// blackboard of floats that each agent running the tree keeps.
+class BehaviourTree {
+	public:
+		BehaviourTree();
+		static BehaviourTree compile(const std::string& text, const std::string& name);
+		static BehaviourTree load(const std::string& filename);
+		bool run(BehaviourAgent& agent, const Message& m, float* blackboard) const;
+		size_t getNumVariables() const;
+	private:
+		unsigned int getEntry(unsigned int i) const;
+		void link(unsigned int i, unsigned int onSuccess, unsigned int onFailure);
+		std::vector<BehaviourNode> mNodes;
+		std::vector<std::string> mVariables;
+		unsigned int mEntry;
+};
+
+#endif
+
@@ -48,6 +48,19 @@ void CellPartitioning<T>::updateEntity(const T& t, const Vector2& oldpos)
 	}
 }
 
+template<class T>
+void CellPartitioning<T>::removeEntity(const T& t)
+{
+	size_t i = getCellIndex(t->getPosition());
+	mCells.at(i).erase(t);
+}
+
+template<class T>
+const typename CellPartitioning<T>::Cell& CellPartitioning<T>::getEntitiesAt(const Vector2& v) const
+{
+	return mCells.at(getCellIndex(v));
+}
+
 template<class T>
 void CellPartitioning<T>::getNeighbouringEntities(const T& t, float range)
 {
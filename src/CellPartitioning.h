@@ -7,19 +7,32 @@
 
 #include "Terrain.h"
 
+// Orders the entities in a cell by their ID rather than their address,
+// so that walking a cell gives the same order in every run.
+template<class T>
+struct EntityIDLess {
+	bool operator()(const T& a, const T& b) const
+	{
+		return a->getEntityID() < b->getEntityID();
+	}
+};
+
 template<class T>
 class CellPartitioning {
 	public:
+		typedef std::set<T, EntityIDLess<T>> Cell;
 		CellPartitioning(float w, int cells);
 		void addEntity(const T& t);
 		void updateEntity(const T& t, const Vector2& oldpos);
+		void removeEntity(const T& t);
+		const Cell& getEntitiesAt(const Vector2& v) const;
 		void getNeighbouringEntities(const T& t, float range);
 		T getNextNeighbouringEntity();
 		bool hasNextNeighbouringEntity();
 
 	private:
 		size_t getCellIndex(Vector2 v) const;
-		std::vector<std::set<T>> mCells;
+		std::vector<Cell> mCells;
 		std::vector<T> mNeighbours;
 		int mCurrentNeighbour;
 
@@ -0,0 +1,103 @@
+#include "Checkpoint.h"
+#include "MilitaryUnit.h"
+
+CheckpointWriter::CheckpointWriter(std::vector<char>& data)
+	: mData(data)
+{
+}
+
+void CheckpointWriter::writePlatoon(const Platoon* p)
+{
+	write<EntityID>(p ? p->getEntityID() : -1);
+}
+
+// The message data is written depending on the message type.
+void CheckpointWriter::writeMessage(const Message& m)
+{
+	write(m.mSender);
+	write(m.mReceiver);
+	write(m.mCreationTime);
+	write(m.mSendTime);
+	write(m.mType);
+	switch(m.mType) {
+		case MessageType::ClaimArea:
+			write(m.mData->area);
+			break;
+
+		case MessageType::Goto:
+			write(m.mData->point);
+			break;
+
+		case MessageType::EnemyDiscovered:
+		case MessageType::PlatoonDied:
+		case MessageType::AttackEnemy:
+			writePlatoon(m.mData->platoon);
+			break;
+
+		case MessageType::ReachedPosition:
+			break;
+	}
+}
+
+CheckpointReader::CheckpointReader(const std::vector<char>& data)
+	: mData(data),
+	mPosition(0)
+{
+}
+
+Platoon* CheckpointReader::readPlatoon()
+{
+	EntityID id = read<EntityID>();
+	if(id == -1)
+		return nullptr;
+	Platoon* p = dynamic_cast<Platoon*>(EntityManager::instance().getEntity(id));
+	if(!p)
+		throw std::runtime_error("Checkpoint refers to an unknown platoon");
+	return p;
+}
+
+Message CheckpointReader::readMessage()
+{
+	EntityID sender = read<EntityID>();
+	EntityID receiver = read<EntityID>();
+	float creationTime = read<float>();
+	float sendTime = read<float>();
+	MessageType type = read<MessageType>();
+	MessageData data;
+	switch(type) {
+		case MessageType::ClaimArea:
+			data.area = read<Area2>();
+			break;
+
+		case MessageType::Goto:
+			data.point = read<Vector2>();
+			break;
+
+		case MessageType::EnemyDiscovered:
+		case MessageType::PlatoonDied:
+		case MessageType::AttackEnemy:
+			data.platoon = readPlatoon();
+			break;
+
+		case MessageType::ReachedPosition:
+			break;
+	}
+	Message m(sender, receiver, creationTime, 0.0f, type, data);
+	m.mCreationTime = creationTime;
+	m.mSendTime = sendTime;
+	return m;
+}
+
+bool CheckpointReader::atEnd() const
+{
+	return mPosition == mData.size();
+}
+
+void CheckpointReader::readBytes(void* p, size_t n)
+{
+	if(n > mData.size() - mPosition)
+		throw std::runtime_error("Checkpoint is truncated");
+	memcpy(p, mData.data() + mPosition, n);
+	mPosition += n;
+}
+
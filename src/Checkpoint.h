@@ -0,0 +1,76 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string.h>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+class Platoon;
+class Message;
+
+// Binary simulation state. Values are stored as raw bytes, so a
+// checkpoint can only be restored by the same build on the same platform.
+// Platoon pointers are stored as entity IDs.
+class CheckpointWriter {
+	public:
+		CheckpointWriter(std::vector<char>& data);
+		template<class T> void write(const T& t);
+		template<class T> void writeVector(const std::vector<T>& v);
+		void writePlatoon(const Platoon* p);
+		void writeMessage(const Message& m);
+	private:
+		std::vector<char>& mData;
+};
+
+class CheckpointReader {
+	public:
+		CheckpointReader(const std::vector<char>& data);
+		template<class T> T read();
+		template<class T> void readVector(std::vector<T>& v);
+		Platoon* readPlatoon();
+		Message readMessage();
+		void readBytes(void* p, size_t n);
+		bool atEnd() const;
+	private:
+		const std::vector<char>& mData;
+		size_t mPosition;
+};
+
+template<class T>
+void CheckpointWriter::write(const T& t)
+{
+	static_assert(std::is_trivially_copyable<T>::value, "Only plain values can be written");
+	const char* p = reinterpret_cast<const char*>(&t);
+	mData.insert(mData.end(), p, p + sizeof(T));
+}
+
+template<class T>
+void CheckpointWriter::writeVector(const std::vector<T>& v)
+{
+	static_assert(std::is_trivially_copyable<T>::value, "Only plain values can be written");
+	write<unsigned int>(v.size());
+	const char* p = reinterpret_cast<const char*>(v.data());
+	mData.insert(mData.end(), p, p + v.size() * sizeof(T));
+}
+
+template<class T>
+T CheckpointReader::read()
+{
+	T t;
+	readBytes(&t, sizeof(T));
+	return t;
+}
+
+template<class T>
+void CheckpointReader::readVector(std::vector<T>& v)
+{
+	unsigned int n = read<unsigned int>();
+	if(n > (mData.size() - mPosition) / sizeof(T))
+		throw std::runtime_error("Checkpoint is truncated");
+	v.resize(n);
+	readBytes(v.data(), n * sizeof(T));
+}
+
+#endif
+
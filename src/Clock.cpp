@@ -1,42 +1,165 @@
-#include <sys/time.h>
-#include <stdlib.h>
-#include <unistd.h>
-#include <iostream>
+#include <math.h>
+#include <algorithm>
+#include <thread>
 
 #include "Clock.h"
 
+// the scheduler may wake us up this late, so the rest is spun
+static const std::chrono::microseconds spin_time(1500);
+
+TimeHistogram::TimeHistogram()
+{
+	clear();
+}
+
+void TimeHistogram::addSample(double seconds)
+{
+	std::atomic<unsigned int>& b = mBuckets[getBucket(seconds)];
+	b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	mSum.store(mSum.load(std::memory_order_relaxed) + seconds, std::memory_order_relaxed);
+	if(seconds > mMax.load(std::memory_order_relaxed))
+		mMax.store(seconds, std::memory_order_relaxed);
+	mCount.store(mCount.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void TimeHistogram::clear()
+{
+	for(auto& b : mBuckets)
+		b = 0;
+	mCount = 0;
+	mSum = 0.0;
+	mMax = 0.0;
+}
+
+unsigned int TimeHistogram::getCount() const
+{
+	return mCount.load(std::memory_order_acquire);
+}
+
+// Interpolates within the bucket the percentile falls in. p is between
+// 0 and 1.
+double TimeHistogram::getPercentile(double p) const
+{
+	unsigned int count = getCount();
+	if(!count)
+		return 0.0;
+	double target = std::max(1.0, p * count);
+	unsigned int sum = 0;
+	for(size_t i = 0; i < TIME_HISTOGRAM_OCTAVES * TIME_HISTOGRAM_STEPS; i++) {
+		unsigned int num = mBuckets[i].load(std::memory_order_relaxed);
+		if(sum + num >= target) {
+			double lower = i ? getBucketLimit(i - 1) : 0.0;
+			double upper = getBucketLimit(i);
+			double t = lower + (upper - lower) * (target - sum) / num;
+			return std::min(t, getMax());
+		}
+		sum += num;
+	}
+	return getMax();
+}
+
+double TimeHistogram::getMean() const
+{
+	unsigned int count = getCount();
+	return count ? mSum.load(std::memory_order_relaxed) / count : 0.0;
+}
+
+double TimeHistogram::getMax() const
+{
+	return mMax.load(std::memory_order_relaxed);
+}
+
+void TimeHistogram::print(std::ostream& os, const char* name) const
+{
+	os << name << ": " << getCount() << " samples, mean " << getMean() * 1000.0
+		<< " ms, p50 " << getPercentile(0.5) * 1000.0
+		<< " ms, p95 " << getPercentile(0.95) * 1000.0
+		<< " ms, p99 " << getPercentile(0.99) * 1000.0
+		<< " ms, max " << getMax() * 1000.0 << " ms\n";
+}
+
+size_t TimeHistogram::getBucket(double seconds)
+{
+	double us = seconds * 1000000.0;
+	if(us < 1.0)
+		return 0;
+	int exp;
+	double mant = frexp(us, &exp);
+	// mant is in [0.5, 1) and exp at least 1
+	size_t bucket = (exp - 1) * TIME_HISTOGRAM_STEPS + size_t((mant * 2.0 - 1.0) * TIME_HISTOGRAM_STEPS);
+	return std::min<size_t>(bucket, TIME_HISTOGRAM_OCTAVES * TIME_HISTOGRAM_STEPS - 1);
+}
+
+double TimeHistogram::getBucketLimit(size_t bucket)
+{
+	size_t octave = bucket / TIME_HISTOGRAM_STEPS;
+	size_t step = bucket % TIME_HISTOGRAM_STEPS;
+	return ldexp(1.0 + double(step + 1) / TIME_HISTOGRAM_STEPS, octave) / 1000000.0;
+}
+
 Clock::Clock()
 	: mFrames(0)
 {
-	mLastTime = getTime();
-	mStatTime = mLastTime;
+	mFrameStart = clock::now();
+	mDeadline = mFrameStart;
+	mStatTime = mFrameStart;
 }
 
+// Sleeps until the frame deadline, less the time it may take for the
+// thread to be woken up, then spins the rest. A frame that is late by
+// more than a whole frame resets the deadlines instead of rushing the
+// following frames.
 void Clock::limitFPS(int fps)
 {
-	double newtime = getTime();
-	double maxadv = 1.0f / fps;
-	double diff = newtime - mLastTime;
-	if(maxadv > diff) {
-		usleep((maxadv - diff) * 1000000);
-		mLastTime = getTime();
+	clock::time_point now = clock::now();
+	mRenderTimes.addSample(std::chrono::duration<double>(now - mFrameStart).count());
+
+	clock::duration period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / fps));
+	mDeadline += period;
+	if(now > mDeadline + period) {
+		mDeadline = now;
 	}
 	else {
-		mLastTime = newtime;
+		if(mDeadline - now > spin_time)
+			std::this_thread::sleep_until(mDeadline - spin_time);
+		while(clock::now() < mDeadline)
+			std::this_thread::yield();
+		now = clock::now();
 	}
+
+	mFrameTimes.addSample(std::chrono::duration<double>(now - mFrameStart).count());
+	mFrameStart = now;
+
 	mFrames++;
-	if(newtime - mStatTime >= 2.0f) {
-		std::cout << "FPS: " << mFrames / (newtime - mStatTime) << "\n";
-		mStatTime = newtime;
+	std::chrono::duration<double> sincestat = now - mStatTime;
+	if(sincestat.count() >= 2.0) {
+		std::cout << "FPS: " << mFrames / sincestat.count() << "\n";
+		mStatTime = now;
 		mFrames = 0;
 	}
 }
 
-double Clock::getTime() const
+// Time between the starts of consecutive frames.
+const TimeHistogram& Clock::getFrameTimes() const
+{
+	return mFrameTimes;
+}
+
+// Time spent in a frame before waiting for the deadline.
+const TimeHistogram& Clock::getRenderTimes() const
 {
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-	return (double)tv.tv_sec + (double)(tv.tv_usec / 1000000.0f);
+	return mRenderTimes;
 }
 
+void Clock::printStatistics(std::ostream& os) const
+{
+	mFrameTimes.print(os, "Frame time");
+	mRenderTimes.print(os, "Render time");
+}
+
+// Monotonic time in seconds.
+double Clock::getTime()
+{
+	return std::chrono::duration<double>(clock::now().time_since_epoch()).count();
+}
 
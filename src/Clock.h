@@ -1,15 +1,55 @@
 #ifndef CLOCK_H
 #define CLOCK_H
 
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+#define TIME_HISTOGRAM_OCTAVES 24
+#define TIME_HISTOGRAM_STEPS 8
+
+// Counts durations in buckets from a microsecond to some 16 seconds.
+// Each doubling of the duration is split in 8 equally wide buckets, so
+// a bucket is 6-12% as wide as the durations in it and the percentiles
+// are accurate to that much. Samples are added by one thread but may be
+// read by others at any time.
+class TimeHistogram {
+	public:
+		TimeHistogram();
+		void addSample(double seconds);
+		void clear();
+		unsigned int getCount() const;
+		double getPercentile(double p) const;
+		double getMean() const;
+		double getMax() const;
+		void print(std::ostream& os, const char* name) const;
+	private:
+		static size_t getBucket(double seconds);
+		static double getBucketLimit(size_t bucket);
+		std::atomic<unsigned int> mBuckets[TIME_HISTOGRAM_OCTAVES * TIME_HISTOGRAM_STEPS];
+		std::atomic<unsigned int> mCount;
+		std::atomic<double> mSum;
+		std::atomic<double> mMax;
+};
+
+// Paces the rendering and keeps the frame time statistics.
 class Clock {
 	public:
 		Clock();
 		void limitFPS(int fps);
+		const TimeHistogram& getFrameTimes() const;
+		const TimeHistogram& getRenderTimes() const;
+		void printStatistics(std::ostream& os) const;
+		static double getTime();
 	private:
-		double getTime() const;
-		double mLastTime;
-		double mStatTime;
+		typedef std::chrono::steady_clock clock;
+		clock::time_point mFrameStart;
+		clock::time_point mDeadline;
+		clock::time_point mStatTime;
 		int mFrames;
+		TimeHistogram mFrameTimes;
+		TimeHistogram mRenderTimes;
 };
 
 #endif
+
@@ -0,0 +1,51 @@
+#include <algorithm>
+
+#include "CombatResolver.h"
+#include "MilitaryUnit.h"
+
+bool CombatResolver::Engagement::operator<(const Engagement& e) const
+{
+	if(mTargetID != e.mTargetID)
+		return mTargetID < e.mTargetID;
+	return mAttackerID < e.mAttackerID;
+}
+
+CombatResolver::CombatResolver()
+	: mNumEngagements(0)
+{
+}
+
+void CombatResolver::addEngagement(Platoon* attacker, Platoon* target, float damage)
+{
+	mEngagements.push_back(Engagement(target->getEntityID(), attacker->getEntityID(),
+				target, damage));
+}
+
+// Applies the damage of all engagements and puts the platoons that were
+// killed in died.
+void CombatResolver::resolve(std::vector<Platoon*>& died)
+{
+	died.clear();
+	mNumEngagements = mEngagements.size();
+	// sorting by the IDs also fixes the order in which the damage is summed
+	std::sort(mEngagements.begin(), mEngagements.end());
+	size_t i = 0;
+	while(i < mEngagements.size()) {
+		Platoon* target = mEngagements[i].mTarget;
+		int id = mEngagements[i].mTargetID;
+		float damage = 0.0f;
+		for(; i < mEngagements.size() && mEngagements[i].mTargetID == id; i++) {
+			damage += mEngagements[i].mDamage;
+		}
+		if(target->loseHealth(damage))
+			died.push_back(target);
+	}
+	mEngagements.clear();
+}
+
+// Number of engagements resolved during the last tick.
+size_t CombatResolver::getNumEngagements() const
+{
+	return mNumEngagements;
+}
+
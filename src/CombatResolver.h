@@ -0,0 +1,32 @@
+#ifndef COMBATRESOLVER_H
+#define COMBATRESOLVER_H
+
+#include <vector>
+
+class Platoon;
+
+// Collects the attacks made during a tick and applies them all at once
+// after every platoon has been updated, so the outcome does not depend on
+// the order in which the platoons were updated.
+class CombatResolver {
+	public:
+		CombatResolver();
+		void addEngagement(Platoon* attacker, Platoon* target, float damage);
+		void resolve(std::vector<Platoon*>& died);
+		size_t getNumEngagements() const;
+	private:
+		struct Engagement {
+			Engagement(int t, int a, Platoon* p, float d)
+				: mTargetID(t), mAttackerID(a), mTarget(p), mDamage(d) { }
+			bool operator<(const Engagement& e) const;
+			int mTargetID;
+			int mAttackerID;
+			Platoon* mTarget;
+			float mDamage;
+		};
+		std::vector<Engagement> mEngagements;
+		size_t mNumEngagements;
+};
+
+#endif
+
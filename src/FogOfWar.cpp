@@ -0,0 +1,194 @@
+#include <algorithm>
+
+#include "FogOfWar.h"
+#include "MilitaryUnit.h"
+#include "Utils.h"
+
+FogOfWar::FogOfWar(float w, int cells, float sightRange)
+	: mSight(nullptr),
+	mTotalWidth(w),
+	mNumCells(cells),
+	mCellWidth(w / (float)cells),
+	mSightRange(sightRange)
+{
+}
+
+void FogOfWar::setup(const LineOfSight* sight)
+{
+	mSight = sight;
+}
+
+void FogOfWar::addObserver(const Platoon* p)
+{
+	Observer& o = mObservers[p];
+	SideGrid& g = getSideGrid(p->getSide());
+	o.mCell = getCellIndex(p->getPosition());
+	o.mSide = p->getSide();
+	computeObservedCells(o.mCell, o.mCells);
+	for(auto c : o.mCells)
+		addCell(g, c);
+}
+
+// Adds an observer whose view is already known, e.g. from a checkpoint.
+void FogOfWar::addObserver(const Platoon* p, const std::vector<unsigned int>& cells)
+{
+	Observer& o = mObservers[p];
+	SideGrid& g = getSideGrid(p->getSide());
+	o.mCell = getCellIndex(p->getPosition());
+	o.mSide = p->getSide();
+	o.mCells = cells;
+	for(auto c : o.mCells)
+		addCell(g, c);
+}
+
+// Returns true if the platoon moved to another cell, in which case the
+// centres of the cells that came into its view are put in enteredCells.
+bool FogOfWar::updateObserver(const Platoon* p, std::vector<Vector2>& enteredCells)
+{
+	enteredCells.clear();
+	auto it = mObservers.find(p);
+	if(it == mObservers.end())
+		return false;
+	Observer& o = it->second;
+	unsigned int cell = getCellIndex(p->getPosition());
+	if(cell == o.mCell)
+		return false;
+
+	o.mCell = cell;
+	computeObservedCells(cell, mNewCells);
+	SideGrid& g = getSideGrid(o.mSide);
+	// both lists are sorted - walk them side by side
+	size_t i = 0, j = 0;
+	while(i < o.mCells.size() || j < mNewCells.size()) {
+		if(j == mNewCells.size() || (i < o.mCells.size() && o.mCells[i] < mNewCells[j])) {
+			removeCell(g, o.mCells[i++]);
+		}
+		else if(i == o.mCells.size() || mNewCells[j] < o.mCells[i]) {
+			addCell(g, mNewCells[j]);
+			enteredCells.push_back(getCellCentre(mNewCells[j]));
+			j++;
+		}
+		else {
+			i++;
+			j++;
+		}
+	}
+	o.mCells.swap(mNewCells);
+	return true;
+}
+
+void FogOfWar::removeObserver(const Platoon* p)
+{
+	auto it = mObservers.find(p);
+	if(it == mObservers.end())
+		return;
+	SideGrid& g = getSideGrid(it->second.mSide);
+	for(auto c : it->second.mCells)
+		removeCell(g, c);
+	mObservers.erase(it);
+}
+
+bool FogOfWar::isVisible(int side, const Vector2& pos) const
+{
+	if(side < 0 || side >= (int)mSides.size() || mSides[side].mBits.empty())
+		return false;
+	unsigned int c = getCellIndex(pos);
+	return (mSides[side].mBits[c / 64] >> (c % 64)) & 1;
+}
+
+// Sorted indices of the cells the platoon currently sees, or nullptr
+// if the platoon is not an observer.
+const std::vector<unsigned int>* FogOfWar::getObservedCells(const Platoon* p) const
+{
+	auto it = mObservers.find(p);
+	if(it == mObservers.end())
+		return nullptr;
+	return &it->second.mCells;
+}
+
+bool FogOfWar::observes(const Platoon* p, const Vector2& pos) const
+{
+	const std::vector<unsigned int>* cells = getObservedCells(p);
+	return cells && std::binary_search(cells->begin(), cells->end(), getCellIndex(pos));
+}
+
+Vector2 FogOfWar::getCellCentre(unsigned int cell) const
+{
+	return Vector2(((cell % mNumCells) + 0.5f) * mCellWidth,
+			((cell / mNumCells) + 0.5f) * mCellWidth);
+}
+
+// One bit per cell, row by row, set if the side sees the cell.
+const std::vector<uint64_t>& FogOfWar::getVisibilityBits(int side)
+{
+	return getSideGrid(side).mBits;
+}
+
+int FogOfWar::getNumCells() const
+{
+	return mNumCells;
+}
+
+unsigned int FogOfWar::getCellIndex(const Vector2& v) const
+{
+	int x = clamp(0, int(v.x / mCellWidth), mNumCells - 1);
+	int y = clamp(0, int(v.y / mCellWidth), mNumCells - 1);
+	return y * mNumCells + x;
+}
+
+void FogOfWar::computeObservedCells(unsigned int cell, std::vector<unsigned int>& cells)
+{
+	cells.clear();
+	mCandidateCells.clear();
+	mQueries.clear();
+	// the view is computed from the cell centre so that it only changes
+	// when the observer changes cells
+	Vector2 eye = getCellCentre(cell);
+	int r = int(mSightRange / mCellWidth);
+	int cx = cell % mNumCells;
+	int cy = cell / mNumCells;
+	for(int j = std::max(0, cy - r); j <= std::min(mNumCells - 1, cy + r); j++) {
+		for(int i = std::max(0, cx - r); i <= std::min(mNumCells - 1, cx + r); i++) {
+			unsigned int c = j * mNumCells + i;
+			Vector2 target = getCellCentre(c);
+			if((target - eye).length() > mSightRange)
+				continue;
+			mCandidateCells.push_back(c);
+			mQueries.push_back(SightQuery(eye, target));
+		}
+	}
+	if(!mSight) {
+		cells = mCandidateCells;
+		return;
+	}
+	mSight->checkLineOfSight(mQueries, mQueryResults);
+	for(size_t i = 0; i < mCandidateCells.size(); i++) {
+		if(mQueryResults[i])
+			cells.push_back(mCandidateCells[i]);
+	}
+}
+
+void FogOfWar::addCell(SideGrid& g, unsigned int cell)
+{
+	if(g.mCounts[cell]++ == 0)
+		g.mBits[cell / 64] |= uint64_t(1) << (cell % 64);
+}
+
+void FogOfWar::removeCell(SideGrid& g, unsigned int cell)
+{
+	if(--g.mCounts[cell] == 0)
+		g.mBits[cell / 64] &= ~(uint64_t(1) << (cell % 64));
+}
+
+FogOfWar::SideGrid& FogOfWar::getSideGrid(int side)
+{
+	if((int)mSides.size() <= side)
+		mSides.resize(side + 1);
+	SideGrid& g = mSides[side];
+	if(g.mCounts.empty()) {
+		g.mCounts.resize(mNumCells * mNumCells);
+		g.mBits.resize((mNumCells * mNumCells + 63) / 64);
+	}
+	return g;
+}
+
@@ -0,0 +1,62 @@
+#ifndef FOGOFWAR_H
+#define FOGOFWAR_H
+
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+
+#include "Terrain.h"
+#include "LineOfSight.h"
+
+class Platoon;
+
+// Per-side visibility grids. Each observing platoon contributes the
+// cells within its sight range that it has line of sight to, and the
+// grids are only updated when a platoon moves to another cell, touching
+// just the cells that enter or leave its view.
+class FogOfWar {
+	public:
+		FogOfWar(float w, int cells, float sightRange);
+		void setup(const LineOfSight* sight);
+		void addObserver(const Platoon* p);
+		void addObserver(const Platoon* p, const std::vector<unsigned int>& cells);
+		bool updateObserver(const Platoon* p, std::vector<Vector2>& enteredCells);
+		void removeObserver(const Platoon* p);
+		bool isVisible(int side, const Vector2& pos) const;
+		const std::vector<unsigned int>* getObservedCells(const Platoon* p) const;
+		bool observes(const Platoon* p, const Vector2& pos) const;
+		Vector2 getCellCentre(unsigned int cell) const;
+		const std::vector<uint64_t>& getVisibilityBits(int side);
+		int getNumCells() const;
+	private:
+		struct Observer {
+			Observer() : mCell(0), mSide(0) { }
+			unsigned int mCell;
+			int mSide;
+			std::vector<unsigned int> mCells;
+		};
+		struct SideGrid {
+			std::vector<unsigned short> mCounts;
+			std::vector<uint64_t> mBits;
+		};
+		unsigned int getCellIndex(const Vector2& v) const;
+		void computeObservedCells(unsigned int cell, std::vector<unsigned int>& cells);
+		void addCell(SideGrid& g, unsigned int cell);
+		void removeCell(SideGrid& g, unsigned int cell);
+		SideGrid& getSideGrid(int side);
+		const LineOfSight* mSight;
+		std::unordered_map<const Platoon*, Observer> mObservers;
+		std::vector<SideGrid> mSides;
+		std::vector<unsigned int> mNewCells;
+		std::vector<unsigned int> mCandidateCells;
+		std::vector<SightQuery> mQueries;
+		std::vector<bool> mQueryResults;
+
+		float mTotalWidth;
+		int mNumCells;
+		float mCellWidth;
+		float mSightRange;
+};
+
+#endif
+
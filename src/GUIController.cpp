@@ -21,7 +21,12 @@ void GUIController::receiveMessage(const Message& m)
 		case MessageType::ClaimArea:
 			{
 				std::cout << "You should go to " << m.mData->area << "\n";
-				mApp->setTargetArea(m.mData->area);
+				if(mApp) {
+					// called on the simulation thread
+					App* app = mApp;
+					Area2 area = m.mData->area;
+					mApp->getSimulation().postToRenderer([=]() { app->setTargetArea(area); });
+				}
 			}
 			break;
 
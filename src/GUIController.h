@@ -12,6 +12,7 @@ class GUIController : public Controller<MilitaryUnit> {
 		bool control(float dt);
 		void receiveMessage(const Message& m);
 	private:
+		// null when replaying without the GUI
 		App* mApp;
 };
 
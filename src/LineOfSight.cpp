@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <math.h>
+
+#include "LineOfSight.h"
+#include "Utils.h"
+
+// height of the eyes of the observer and of the observed unit above ground
+static const float eyeHeight = 0.4f;
+// height of the vegetation at vegetation density 1
+static const float canopyHeight = 0.6f;
+// obstructions this close to either end of the ray are ignored so that
+// units can see out of the cell they're in
+static const float nearRange = 0.5f;
+
+LineOfSight::LineOfSight()
+	: mNumCells(0),
+	mCellWidth(1.0f),
+	mTotalWidth(0.0f)
+{
+}
+
+// cells must be a power of two.
+void LineOfSight::setup(const Terrain& t, int cells)
+{
+	mNumCells = cells;
+	mTotalWidth = t.getWidth();
+	mCellWidth = mTotalWidth / cells;
+	mGround.resize(cells * cells);
+	mMaxHeights.clear();
+	mMaxHeights.push_back(std::vector<float>(cells * cells));
+	for(int j = 0; j < cells; j++) {
+		for(int i = 0; i < cells; i++) {
+			Vector2 v((i + 0.5f) * mCellWidth, (j + 0.5f) * mCellWidth);
+			float h = t.getHeightAt(v) * t.getHeightScale();
+			mGround[j * cells + i] = h;
+			mMaxHeights[0][j * cells + i] = h + t.getVegetationAt(v) * canopyHeight;
+		}
+	}
+	for(int size = cells / 2; size >= 1; size /= 2) {
+		const std::vector<float>& lower = mMaxHeights.back();
+		std::vector<float> level(size * size);
+		for(int j = 0; j < size; j++) {
+			for(int i = 0; i < size; i++) {
+				int li = j * 2 * size * 2 + i * 2;
+				level[j * size + i] = std::max(std::max(lower[li], lower[li + 1]),
+						std::max(lower[li + size * 2], lower[li + size * 2 + 1]));
+			}
+		}
+		mMaxHeights.push_back(level);
+	}
+}
+
+bool LineOfSight::hasLineOfSight(const Vector2& from, const Vector2& to) const
+{
+	Vector2 dir = to - from;
+	float len = dir.length();
+	if(len <= nearRange * 2.0f || mNumCells == 0)
+		return true;
+
+	float z0 = getGroundHeight(from) + eyeHeight;
+	float z1 = getGroundHeight(to) + eyeHeight;
+	float t = nearRange / len;
+	float tend = 1.0f - t;
+	// only the part of the ray that is on the map can be obstructed
+	if(!clipToMap(from, dir, t, tend))
+		return true;
+	// points on cell boundaries are nudged into the cell the ray is entering
+	Vector2 nudge(dir.x > 0.0f ? mCellWidth * 0.001f : -mCellWidth * 0.001f,
+			dir.y > 0.0f ? mCellWidth * 0.001f : -mCellWidth * 0.001f);
+	float eps = mCellWidth * 0.001f / len;
+	int maxlevel = mMaxHeights.size() - 1;
+
+	// start from the level where a cell is about the size of the ray
+	int level = 0;
+	while(level < maxlevel && (mCellWidth * (2 << level)) < len)
+		level++;
+
+	while(t < tend) {
+		Vector2 p = from + dir * t + nudge;
+		int size = mNumCells >> level;
+		float cw = mCellWidth * (1 << level);
+		int cx = getCellCoordinate(p.x, level);
+		int cy = getCellCoordinate(p.y, level);
+
+		// parameter at which the ray leaves the current cell
+		float texit = tend;
+		if(dir.x > 0.0f)
+			texit = std::min(texit, ((cx + 1) * cw - from.x) / dir.x);
+		else if(dir.x < 0.0f)
+			texit = std::min(texit, (cx * cw - from.x) / dir.x);
+		if(dir.y > 0.0f)
+			texit = std::min(texit, ((cy + 1) * cw - from.y) / dir.y);
+		else if(dir.y < 0.0f)
+			texit = std::min(texit, (cy * cw - from.y) / dir.y);
+
+		float zmin = std::min(z0 + (z1 - z0) * t, z0 + (z1 - z0) * texit);
+		if(zmin > mMaxHeights[level][cy * size + cx]) {
+			// the whole cell is below the ray - skip it
+			t = std::max(texit, t + eps);
+			// and continue on the coarser level once the ray leaves the coarser cell
+			if(level < maxlevel) {
+				Vector2 np = from + dir * t + nudge;
+				if(getCellCoordinate(np.x, level + 1) != cx / 2 ||
+						getCellCoordinate(np.y, level + 1) != cy / 2)
+					level++;
+			}
+		}
+		else if(level == 0) {
+			return false;
+		}
+		else {
+			level--;
+		}
+	}
+	return true;
+}
+
+void LineOfSight::checkLineOfSight(const std::vector<SightQuery>& queries,
+		std::vector<bool>& results) const
+{
+	results.resize(queries.size());
+	for(size_t i = 0; i < queries.size(); i++) {
+		results[i] = hasLineOfSight(queries[i].mFrom, queries[i].mTo);
+	}
+}
+
+bool LineOfSight::clipToMap(const Vector2& from, const Vector2& dir, float& t0, float& t1) const
+{
+	float starts[2] = { from.x, from.y };
+	float dirs[2] = { dir.x, dir.y };
+	for(int i = 0; i < 2; i++) {
+		if(dirs[i] == 0.0f) {
+			if(starts[i] < 0.0f || starts[i] > mTotalWidth)
+				return false;
+			continue;
+		}
+		float ta = (0.0f - starts[i]) / dirs[i];
+		float tb = (mTotalWidth - starts[i]) / dirs[i];
+		t0 = std::max(t0, std::min(ta, tb));
+		t1 = std::min(t1, std::max(ta, tb));
+	}
+	return t0 < t1;
+}
+
+int LineOfSight::getCellCoordinate(float f, int level) const
+{
+	return clamp(0, int(f / mCellWidth) >> level, (mNumCells >> level) - 1);
+}
+
+float LineOfSight::getGroundHeight(const Vector2& v) const
+{
+	return mGround[getCellCoordinate(v.y, 0) * mNumCells + getCellCoordinate(v.x, 0)];
+}
+
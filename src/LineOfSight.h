@@ -0,0 +1,37 @@
+#ifndef LINEOFSIGHT_H
+#define LINEOFSIGHT_H
+
+#include <vector>
+
+#include "Terrain.h"
+
+struct SightQuery {
+	SightQuery(const Vector2& from, const Vector2& to)
+		: mFrom(from), mTo(to) { }
+	Vector2 mFrom;
+	Vector2 mTo;
+};
+
+// Line of sight tests against the terrain height and vegetation. The
+// obstruction heights are rasterised once and stored with a pyramid of
+// maximum heights so that rays can skip large unobstructed areas.
+class LineOfSight {
+	public:
+		LineOfSight();
+		void setup(const Terrain& t, int cells);
+		bool hasLineOfSight(const Vector2& from, const Vector2& to) const;
+		void checkLineOfSight(const std::vector<SightQuery>& queries,
+				std::vector<bool>& results) const;
+	private:
+		bool clipToMap(const Vector2& from, const Vector2& dir, float& t0, float& t1) const;
+		int getCellCoordinate(float f, int level) const;
+		float getGroundHeight(const Vector2& v) const;
+		std::vector<float> mGround;
+		std::vector<std::vector<float>> mMaxHeights;
+		int mNumCells;
+		float mCellWidth;
+		float mTotalWidth;
+};
+
+#endif
+
@@ -0,0 +1,103 @@
+#include <algorithm>
+
+#include "MarkerGrid.h"
+
+MarkerGrid::MarkerGrid(float w, int cells, size_t maxmarkers)
+	: mMarkers(maxmarkers),
+	mNumCells(cells),
+	mCellWidth(w / (float)cells)
+{
+	mCells.resize(mNumCells * mNumCells);
+}
+
+void MarkerGrid::addMarker(size_t id, const Vector2& pos)
+{
+	Entry& e = mMarkers.at(id);
+	if(e.mPresent) {
+		moveMarker(id, pos);
+		return;
+	}
+	e.mPosition = pos;
+	e.mPresent = true;
+	insert(id, getCellIndex(pos));
+}
+
+void MarkerGrid::moveMarker(size_t id, const Vector2& pos)
+{
+	Entry& e = mMarkers.at(id);
+	if(!e.mPresent)
+		return;
+	e.mPosition = pos;
+	size_t cell = getCellIndex(pos);
+	if(cell != e.mCell) {
+		erase(id);
+		insert(id, cell);
+	}
+}
+
+void MarkerGrid::removeMarker(size_t id)
+{
+	Entry& e = mMarkers.at(id);
+	if(!e.mPresent)
+		return;
+	erase(id);
+	e.mPresent = false;
+}
+
+// Returns the id of the marker closest to the point within the radius,
+// or -1 if there is none. Only the cells overlapping the radius are
+// searched.
+int MarkerGrid::findNearest(const Vector2& v, float radius) const
+{
+	int x0 = getCell(v.x - radius);
+	int x1 = getCell(v.x + radius);
+	int y0 = getCell(v.y - radius);
+	int y1 = getCell(v.y + radius);
+	int nearest = -1;
+	float nearestdist = radius * radius;
+	for(int j = y0; j <= y1; j++) {
+		for(int i = x0; i <= x1; i++) {
+			for(auto id : mCells[j * mNumCells + i]) {
+				const Vector2& pos = mMarkers[id].mPosition;
+				float dx = pos.x - v.x;
+				float dy = pos.y - v.y;
+				float dist = dx * dx + dy * dy;
+				if(dist <= nearestdist) {
+					nearest = id;
+					nearestdist = dist;
+				}
+			}
+		}
+	}
+	return nearest;
+}
+
+// Markers outside the map are kept in the edge cells.
+int MarkerGrid::getCell(float f) const
+{
+	return std::max(0, std::min(mNumCells - 1, int(f / mCellWidth)));
+}
+
+size_t MarkerGrid::getCellIndex(const Vector2& v) const
+{
+	return getCell(v.y) * mNumCells + getCell(v.x);
+}
+
+void MarkerGrid::insert(size_t id, size_t cell)
+{
+	Entry& e = mMarkers[id];
+	e.mCell = cell;
+	e.mSlot = mCells[cell].size();
+	mCells[cell].push_back(id);
+}
+
+void MarkerGrid::erase(size_t id)
+{
+	const Entry& e = mMarkers[id];
+	std::vector<size_t>& c = mCells[e.mCell];
+	size_t last = c.back();
+	c[e.mSlot] = last;
+	mMarkers[last].mSlot = e.mSlot;
+	c.pop_back();
+}
+
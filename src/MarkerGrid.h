@@ -0,0 +1,40 @@
+#ifndef MARKERGRID_H
+#define MARKERGRID_H
+
+#include <vector>
+
+#include "Terrain.h"
+
+// A uniform grid of the unit markers of one scale for picking. The
+// markers are identified by their index in the marker tables. Each cell
+// keeps a list of its markers, so moving a marker within its cell only
+// updates its position and moving it to another cell is a swap and pop.
+class MarkerGrid {
+	public:
+		MarkerGrid(float w, int cells, size_t maxmarkers);
+		void addMarker(size_t id, const Vector2& pos);
+		void moveMarker(size_t id, const Vector2& pos);
+		void removeMarker(size_t id);
+		int findNearest(const Vector2& v, float radius) const;
+
+	private:
+		struct Entry {
+			Entry()
+				: mCell(0), mSlot(0), mPresent(false) { }
+			size_t mCell;
+			size_t mSlot;
+			Vector2 mPosition;
+			bool mPresent;
+		};
+		size_t getCellIndex(const Vector2& v) const;
+		int getCell(float f) const;
+		void insert(size_t id, size_t cell);
+		void erase(size_t id);
+		std::vector<std::vector<size_t>> mCells;
+		std::vector<Entry> mMarkers;
+		int mNumCells;
+		float mCellWidth;
+};
+
+#endif
+
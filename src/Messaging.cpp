@@ -1,7 +1,9 @@
 #include <iostream>
+#include <algorithm>
 
 #include "Messaging.h"
 #include "Papaya.h"
+#include "Trace.h"
 
 Message::Message(EntityID sender, EntityID receiver, float creationTime, float delay,
 		MessageType type, const MessageData& data)
@@ -105,17 +107,36 @@ void MessageDispatcher::sendMessage(const Message& m)
 
 void MessageDispatcher::queueMessage(const Message& m)
 {
-	mMessageQueue.push(m);
+	mMessageQueue.push_back(m);
+	std::push_heap(mMessageQueue.begin(), mMessageQueue.end(), messageSendCompare());
 }
 
 void MessageDispatcher::dispatchQueuedMessages()
 {
+	TRACE_ZONE("Messaging");
 	float time = Papaya::instance().getCurrentTime();
-	while(!mMessageQueue.empty() && mMessageQueue.top().mSendTime <= time) {
-		const Message& m = mMessageQueue.top();
+	while(!mMessageQueue.empty() && mMessageQueue.front().mSendTime <= time) {
+		std::pop_heap(mMessageQueue.begin(), mMessageQueue.end(), messageSendCompare());
+		Message m = mMessageQueue.back();
+		mMessageQueue.pop_back();
 		sendMessage(m);
-		mMessageQueue.pop();
 	}
 }
 
+void MessageDispatcher::saveState(CheckpointWriter& w) const
+{
+	w.write<unsigned int>(mMessageQueue.size());
+	for(auto& m : mMessageQueue) {
+		w.writeMessage(m);
+	}
+}
+
+void MessageDispatcher::loadState(CheckpointReader& r)
+{
+	unsigned int n = r.read<unsigned int>();
+	mMessageQueue.clear();
+	for(unsigned int i = 0; i < n; i++) {
+		mMessageQueue.push_back(r.readMessage());
+	}
+}
 
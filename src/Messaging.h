@@ -4,9 +4,9 @@
 #include <map>
 #include <memory>
 #include <vector>
-#include <queue>
 
 #include "Terrain.h"
+#include "Checkpoint.h"
 
 enum class MessageType {
 	ClaimArea,
@@ -81,11 +81,15 @@ class MessageDispatcher {
 		void dispatchMessage(const Message& m);
 		void registerWorldEntity(WorldEntity* e);
 		void dispatchQueuedMessages();
+		void saveState(CheckpointWriter& w) const;
+		void loadState(CheckpointReader& r);
 	private:
 		void queueMessage(const Message& m);
 		void sendMessage(const Message& m);
 		std::vector<WorldEntity*> mWorldEntities;
-		std::priority_queue<Message, std::vector<Message>, messageSendCompare> mMessageQueue;
+		// a heap with the earliest message first - not a priority_queue,
+		// so that checkpoints can store it as it is
+		std::vector<Message> mMessageQueue;
 };
 
 #endif
@@ -1,6 +1,7 @@
 #include <memory>
 #include <list>
 #include <iostream>
+#include <stdexcept>
 
 #include "MilitaryUnit.h"
 #include "MilitaryUnitAI.h"
@@ -13,7 +14,7 @@ Platoon::Platoon(MilitaryUnit* commandingunit, const Vector2& pos, ServiceBranch
 	mPosition(pos),
 	mController(nullptr),
 	mHealth(100.0f),
-	mVisibilityCheckDelay(0.0f)
+	mActivity(Activity::Awake)
 {
 	mController = std::shared_ptr<Controller<Platoon>>(new PlatoonAIController(this));
 }
@@ -23,22 +24,15 @@ ServiceBranch Platoon::getBranch() const
 	return mBranch;
 }
 
-std::list<Platoon*> Platoon::update(float dt)
+// Adds the platoon to changed if the update changed it.
+void Platoon::update(float dt, std::vector<Platoon*>& changed)
 {
 	if(isDead()) {
-		return std::list<Platoon*>();
-	}
-	mVisibilityCheckDelay -= dt;
-	if(mVisibilityCheckDelay <= 0.0f) {
-		mVisibilityCheckDelay = 1.0f;
-		checkVisibility();
-	}
-	if(mController->control(dt)) {
-		return std::list<Platoon*>(1, this);
-	}
-	else {
-		return std::list<Platoon*>();
+		Papaya::instance().sleepPlatoon(this);
+		return;
 	}
+	if(mController->control(dt))
+		changed.push_back(this);
 }
 
 std::list<Platoon*> Platoon::getPlatoons()
@@ -63,6 +57,7 @@ void Platoon::setPosition(const Vector2& v)
 
 void Platoon::receiveMessage(const Message& m)
 {
+	Papaya::instance().wakePlatoon(this);
 	mController->receiveMessage(m);
 }
 
@@ -73,16 +68,29 @@ void Platoon::setController(std::shared_ptr<Controller<Platoon>> c)
 
 void Platoon::checkVisibility()
 {
-	for(Platoon* p = Papaya::instance().getNeighbouringPlatoons(this, 4.0f);
-			p != nullptr;
-			p = Papaya::instance().getNextNeighbouringPlatoon()) {
-		if(p->getSide() != getSide() && !p->isDead()) {
-			MessageDispatcher::instance().dispatchMessage(Message(mEntityID, mEntityID,
-						0.0f, 0.0f, MessageType::EnemyDiscovered, p));
-		}
+	std::vector<Platoon*> enemies;
+	Papaya::instance().findVisibleEnemies(this, enemies);
+	for(auto e : enemies) {
+		MessageDispatcher::instance().dispatchMessage(Message(mEntityID, mEntityID,
+					0.0f, 0.0f, MessageType::EnemyDiscovered, e));
 	}
 }
 
+Posture Platoon::getPosture() const
+{
+	return mController->getPosture();
+}
+
+Activity Platoon::getActivity() const
+{
+	return mActivity;
+}
+
+void Platoon::setActivity(Activity a)
+{
+	mActivity = a;
+}
+
 UnitSize Platoon::getUnitSize() const
 {
 	return UnitSize::Platoon;
@@ -122,14 +130,12 @@ void Platoon::moveTowards(const Vector2& v, float dt)
 	Papaya::instance().updateEntityPosition(this, oldpos);
 }
 
-void Platoon::loseHealth(float damage)
+// Returns true if the platoon was killed.
+bool Platoon::loseHealth(float damage)
 {
 	bool wasdead = isDead();
 	mHealth -= damage;
-	if(!wasdead && isDead()) {
-		MessageDispatcher::instance().dispatchMessage(Message(mEntityID, WORLD_ENTITY_ID,
-					0.0f, 0.0f, MessageType::PlatoonDied, this));
-	}
+	return !wasdead && isDead();
 }
 
 bool Platoon::isDead() const
@@ -160,6 +166,26 @@ float Platoon::getHealth() const
 	return std::max(0.0f, mHealth);
 }
 
+void Platoon::saveState(CheckpointWriter& w) const
+{
+	saveStructure(w);
+	w.write(mPosition);
+	w.write(mHealth);
+	w.write(mActivity);
+	mController->saveState(w);
+}
+
+// The platoon must be removed from Papaya's position bookkeeping before
+// loading and added back afterwards.
+void Platoon::loadState(CheckpointReader& r)
+{
+	checkStructure(r);
+	mPosition = r.read<Vector2>();
+	mHealth = r.read<float>();
+	mActivity = r.read<Activity>();
+	mController->loadState(r);
+}
+
 MilitaryUnit::MilitaryUnit(MilitaryUnit* commandingunit, ServiceBranch b, int side)
 	: mCommandingUnit(commandingunit),
 	mBranch(b),
@@ -213,13 +239,49 @@ std::list<Platoon*> MilitaryUnit::getPlatoons()
 	return units;
 }
 
-std::list<Platoon*> MilitaryUnit::update(float dt)
+void MilitaryUnit::update(float dt, std::vector<Platoon*>& changed)
 {
-	std::list<Platoon*> units;
 	for(auto& u : mUnits) {
-		units.splice(units.end(), u->update(dt));
+		u->update(dt, changed);
 	}
-	return units;
+}
+
+// Writes the state of the unit and its subunits.
+void MilitaryUnit::saveState(CheckpointWriter& w) const
+{
+	saveStructure(w);
+	mController->saveState(w);
+	for(auto& u : mUnits) {
+		u->saveState(w);
+	}
+}
+
+void MilitaryUnit::loadState(CheckpointReader& r)
+{
+	checkStructure(r);
+	mController->loadState(r);
+	for(auto& u : mUnits) {
+		u->loadState(r);
+	}
+}
+
+// The unit hierarchy is not restored but recreated by the scenario setup,
+// so the checkpoint must match it.
+void MilitaryUnit::saveStructure(CheckpointWriter& w) const
+{
+	w.write(mEntityID);
+	w.write(getUnitSize());
+	w.write(mBranch);
+	w.write<unsigned int>(mUnits.size());
+}
+
+void MilitaryUnit::checkStructure(CheckpointReader& r) const
+{
+	if(r.read<EntityID>() != mEntityID ||
+			r.read<UnitSize>() != getUnitSize() ||
+			r.read<ServiceBranch>() != mBranch ||
+			r.read<unsigned int>() != mUnits.size())
+		throw std::runtime_error("Checkpoint does not match the unit hierarchy");
 }
 
 Vector2 MilitaryUnit::getPosition() const
@@ -246,6 +308,7 @@ Company::Company(MilitaryUnit* commandingunit, const Vector2& pos, ServiceBranch
 		std::shared_ptr<Platoon> p(new Platoon(this, pos + spawnUnitDisplacement(), mBranch, mSide));
 		mUnits.push_back(p);
 		Papaya::instance().addEntityPosition(p.get());
+		Papaya::instance().addPlatoon(p.get());
 	}
 }
 
@@ -296,4 +359,9 @@ void MilitaryUnit::setController(std::shared_ptr<Controller<MilitaryUnit>> c)
 	mController = c;
 }
 
+void MilitaryUnit::subunitDied()
+{
+	mController->subunitDied();
+}
+
 
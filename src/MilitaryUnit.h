@@ -5,6 +5,7 @@
 
 #include "Messaging.h"
 #include "Steering.h"
+#include "Checkpoint.h"
 
 class Platoon;
 
@@ -18,6 +19,8 @@ enum class ServiceBranch {
 	Supply
 };
 
+#define NUM_SERVICE_BRANCHES 7
+
 enum class UnitSize {
 	Single,
 	Squad,
@@ -30,6 +33,24 @@ enum class UnitSize {
 
 class MilitaryUnit;
 
+enum class Activity {
+	Awake,
+	Drowsy,
+	Asleep
+};
+
+enum class Posture {
+	Holding,
+	Moving,
+	Engaged
+};
+
+enum class UpdateTier {
+	Contact,
+	Marching,
+	Reserve
+};
+
 template <class T>
 class Controller {
 	public:
@@ -37,6 +58,11 @@ class Controller {
 		~Controller<T>() { }
 		virtual bool control(float dt) = 0;
 		virtual void receiveMessage(const Message& m) = 0;
+		virtual Posture getPosture() const { return Posture::Holding; }
+		virtual void saveState(CheckpointWriter& w) const { }
+		virtual void loadState(CheckpointReader& r) { }
+		// called when a platoon under the unit has died
+		virtual void subunitDied() { }
 	protected:
 		T* mUnit;
 };
@@ -54,7 +80,7 @@ class MilitaryUnit : public Entity {
 		virtual ~MilitaryUnit() { }
 		ServiceBranch getBranch() const;
 		int getSide() const;
-		virtual std::list<Platoon*> update(float dt);
+		virtual void update(float dt, std::vector<Platoon*>& changed);
 		virtual void receiveMessage(const Message& m);
 		virtual std::list<Platoon*> getPlatoons();
 		const std::vector<std::shared_ptr<MilitaryUnit>>& getUnits() const;
@@ -65,10 +91,15 @@ class MilitaryUnit : public Entity {
 		virtual Vector2 getPosition() const;
 		float distanceTo(const MilitaryUnit& m) const;
 		void setController(std::shared_ptr<Controller<MilitaryUnit>> c);
+		void subunitDied();
 		virtual bool isDead() const;
 		virtual float getHealth() const;
+		virtual void saveState(CheckpointWriter& w) const;
+		virtual void loadState(CheckpointReader& r);
 	protected:
 		Vector2 spawnUnitDisplacement() const;
+		void saveStructure(CheckpointWriter& w) const;
+		void checkStructure(CheckpointReader& r) const;
 		MilitaryUnit* mCommandingUnit;
 		ServiceBranch mBranch;
 		int mSide;
@@ -85,21 +116,26 @@ class Platoon : public MilitaryUnit {
 		void setPosition(const Vector2& v);
 		ServiceBranch getBranch() const;
 		int getSide() const;
-		std::list<Platoon*> update(float dt);
+		void update(float dt, std::vector<Platoon*>& changed);
 		void receiveMessage(const Message& m);
 		std::list<Platoon*> getPlatoons();
 		void setController(std::shared_ptr<Controller<Platoon>> c);
-		void loseHealth(float damage);
+		bool loseHealth(float damage);
 		bool isDead() const;
 		float getHealth() const;
 		void moveTowards(const Vector2& v, float dt);
 		UnitSize getUnitSize() const;
-	private:
+		Posture getPosture() const;
+		Activity getActivity() const;
+		void setActivity(Activity a);
 		void checkVisibility();
+		void saveState(CheckpointWriter& w) const;
+		void loadState(CheckpointReader& r);
+	private:
 		Vector2 mPosition;
 		std::shared_ptr<Controller<Platoon>> mController;
 		float mHealth;
-		float mVisibilityCheckDelay;
+		Activity mActivity;
 };
 
 class Company : public MilitaryUnit {
@@ -1,9 +1,20 @@
 #include <vector>
 #include <iostream>
+#include <stdexcept>
 #include "MilitaryUnitAI.h"
+#include "Papaya.h"
+#include "Assignment.h"
+
+static const BehaviourTree& getFormationTree()
+{
+	static BehaviourTree tree = BehaviourTree::load("share/formation.bt");
+	return tree;
+}
 
 MilitaryUnitAIController::MilitaryUnitAIController(MilitaryUnit* m)
-	: Controller<MilitaryUnit>(m)
+	: Controller<MilitaryUnit>(m),
+	mBlackboard(getFormationTree().getNumVariables()),
+	mCombatUnitsValid(false)
 {
 }
 
@@ -14,78 +25,112 @@ bool MilitaryUnitAIController::control(float dt)
 
 void MilitaryUnitAIController::receiveMessage(const Message& m)
 {
-	switch(m.mType) {
-		case MessageType::Goto:
-			std::cout << "Military Unit does not support Goto. Use ClaimArea instead.\n";
-			break;
+	if(!getFormationTree().run(*this, m, mBlackboard.data()))
+		std::cout << "Unhandled message " << int(m.mType) << " in MilitaryUnitAIController.\n";
+}
 
-		case MessageType::ClaimArea:
-			{
-				std::vector<std::shared_ptr<MilitaryUnit>> combatUnits = getCombatUnits();
-				float awidth = m.mData->area.x2 - m.mData->area.x1;
-				float aheight = m.mData->area.y2 - m.mData->area.y1;
-				std::vector<Area2> areas;
-				if(awidth > aheight) {
-					for(size_t i = 0; i < combatUnits.size(); i++) {
-						areas.push_back(Area2(m.mData->area.x1 + awidth * i / combatUnits.size(),
-									m.mData->area.y1,
-									m.mData->area.x1 + awidth * (i + 1) / combatUnits.size(),
-									m.mData->area.y2));
-					}
-				}
-				else {
-					for(size_t i = 0; i < combatUnits.size(); i++) {
-						areas.push_back(Area2(m.mData->area.x1,
-									m.mData->area.y1 + aheight * i / combatUnits.size(),
-									m.mData->area.x2,
-									m.mData->area.y1 + aheight * (i + 1) / combatUnits.size()));
-					}
-				}
-				for(size_t i = 0; i < combatUnits.size(); i++) {
-					MessageDispatcher::instance().dispatchMessage(Message(mUnit->getEntityID(),
-								combatUnits[i]->getEntityID(),
-								0.0f, 0.0f, MessageType::ClaimArea, areas[i]));
-				}
-			}
-			break;
+void MilitaryUnitAIController::saveState(CheckpointWriter& w) const
+{
+	w.writeVector(mBlackboard);
+}
 
-		case MessageType::EnemyDiscovered:
-			attackPlatoon(m.mData->platoon);
-			if(mUnit->getCommandingUnit())
-				MessageDispatcher::instance().dispatchMessage(Message(mUnit->getEntityID(), mUnit->getCommandingUnit()->getEntityID(),
-							0.0f, 0.0f, MessageType::EnemyDiscovered, m.mData->platoon));
-			break;
+void MilitaryUnitAIController::loadState(CheckpointReader& r)
+{
+	r.readVector(mBlackboard);
+	if(mBlackboard.size() != getFormationTree().getNumVariables())
+		throw std::runtime_error("Checkpoint does not match the formation behaviour tree");
+	// subunits may have died or come back to life
+	mCombatUnitsValid = false;
+}
+
+void MilitaryUnitAIController::subunitDied()
+{
+	mCombatUnitsValid = false;
+}
+
+bool MilitaryUnitAIController::runBehaviour(const BehaviourNode& n, const Message& m)
+{
+	switch(n.mType) {
+		case BehaviourNodeType::SplitArea:
+			splitArea(m.mData->area);
+			return true;
 
-		case MessageType::AttackEnemy:
+		case BehaviourNodeType::AttackEnemy:
 			attackPlatoon(m.mData->platoon);
-			break;
+			return true;
 
-		case MessageType::ReachedPosition:
-			// Nothing to do, I guess.
-			break;
+		case BehaviourNodeType::Report:
+			if(mUnit->getCommandingUnit())
+				MessageDispatcher::instance().dispatchMessage(Message(mUnit->getEntityID(), mUnit->getCommandingUnit()->getEntityID(),
+							0.0f, 0.0f, m.mType, *m.mData));
+			return true;
 
 		default:
-			std::cout << "Unhandled message " << int(m.mType) << " in MilitaryUnitAIController.\n";
-			break;
+			return false;
+	}
+}
+
+// Splits the area in equal strips and assigns them to the combat units
+// so that the total travel time to the strip centres is minimal.
+void MilitaryUnitAIController::splitArea(const Area2& area)
+{
+	const std::vector<MilitaryUnit*>& combatUnits = getCombatUnits();
+	int n = combatUnits.size();
+	float awidth = area.x2 - area.x1;
+	float aheight = area.y2 - area.y1;
+	std::vector<Area2> areas;
+	if(awidth > aheight) {
+		for(int i = 0; i < n; i++) {
+			areas.push_back(Area2(area.x1 + awidth * i / n,
+						area.y1,
+						area.x1 + awidth * (i + 1) / n,
+						area.y2));
+		}
+	}
+	else {
+		for(int i = 0; i < n; i++) {
+			areas.push_back(Area2(area.x1,
+						area.y1 + aheight * i / n,
+						area.x2,
+						area.y1 + aheight * (i + 1) / n));
+		}
+	}
+	std::vector<float> costs(n * n);
+	for(int i = 0; i < n; i++) {
+		Vector2 pos = combatUnits[i]->getPosition();
+		for(int j = 0; j < n; j++) {
+			Vector2 centre((areas[j].x1 + areas[j].x2) / 2.0f,
+					(areas[j].y1 + areas[j].y2) / 2.0f);
+			costs[i * n + j] = Papaya::instance().getTravelTime(combatUnits[i]->getBranch(),
+					pos, centre);
+		}
+	}
+	std::vector<int> assignment = solveAssignment(costs, n);
+	for(int i = 0; i < n; i++) {
+		MessageDispatcher::instance().dispatchMessage(Message(mUnit->getEntityID(),
+					combatUnits[i]->getEntityID(),
+					0.0f, 0.0f, MessageType::ClaimArea, areas[assignment[i]]));
 	}
 }
 
-std::vector<std::shared_ptr<MilitaryUnit>> MilitaryUnitAIController::getCombatUnits() const
+const std::vector<MilitaryUnit*>& MilitaryUnitAIController::getCombatUnits()
 {
-	std::vector<std::shared_ptr<MilitaryUnit>> combatUnits;
-	for(auto& u : mUnit->getUnits()) {
-		if(isCombatBranch(u->getBranch()))
-			combatUnits.push_back(u);
+	if(!mCombatUnitsValid) {
+		mCombatUnits.clear();
+		for(auto& u : mUnit->getUnits()) {
+			if(!u->isDead() && isCombatBranch(u->getBranch()))
+				mCombatUnits.push_back(u.get());
+		}
+		mCombatUnitsValid = true;
 	}
-	return combatUnits;
+	return mCombatUnits;
 }
 
 void MilitaryUnitAIController::attackPlatoon(Platoon* p)
 {
-	for(auto& u : getCombatUnits()) {
+	for(auto u : getCombatUnits()) {
 		MessageDispatcher::instance().dispatchMessage(Message(mUnit->getEntityID(),
-					u->getEntityID(),
-					0.0f, 0.0f, MessageType::AttackEnemy, p));
+					u->getEntityID(), 0.0f, 0.0f, MessageType::AttackEnemy, p));
 	}
 }
 
@@ -4,16 +4,28 @@
 #include <vector>
 #include "MilitaryUnit.h"
 #include "Messaging.h"
+#include "BehaviourTree.h"
 
-class MilitaryUnitAIController : public Controller<MilitaryUnit> {
+// Messages are handled by running the formation behaviour tree.
+class MilitaryUnitAIController : public Controller<MilitaryUnit>, public BehaviourAgent {
 	public:
 		MilitaryUnitAIController(MilitaryUnit* m);
 		virtual void receiveMessage(const Message& m);
 		virtual bool control(float dt);
+		bool runBehaviour(const BehaviourNode& n, const Message& m);
+		void saveState(CheckpointWriter& w) const;
+		void loadState(CheckpointReader& r);
+		void subunitDied();
 	protected:
-		std::vector<std::shared_ptr<MilitaryUnit>> getCombatUnits() const;
+		const std::vector<MilitaryUnit*>& getCombatUnits();
+		void splitArea(const Area2& area);
 		void attackPlatoon(Platoon* p);
 		bool mInCombat;
+		std::vector<float> mBlackboard;
+		// the living combat subunits, refreshed when a platoon under
+		// the unit has died
+		std::vector<MilitaryUnit*> mCombatUnits;
+		bool mCombatUnitsValid;
 };
 
 #endif
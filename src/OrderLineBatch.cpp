@@ -0,0 +1,118 @@
+#include <algorithm>
+
+#include "OrderLineBatch.h"
+
+// two vertices of x, y, z
+#define SEGMENT_FLOATS 6
+
+OrderLineBatch::OrderLineBatch(const std::string& material, const Terrain& t, float height)
+	: mHeight(height),
+	mBoundingRadius(t.getWidth() * 1.5f),
+	mCapacity(0),
+	mNumSegments(0),
+	mDirtyBegin(0),
+	mDirtyEnd(0)
+{
+	mRenderOp.vertexData = new Ogre::VertexData();
+	mRenderOp.vertexData->vertexStart = 0;
+	mRenderOp.vertexData->vertexCount = 0;
+	mRenderOp.vertexData->vertexDeclaration->addElement(0, 0, Ogre::VET_FLOAT3, Ogre::VES_POSITION);
+	mRenderOp.indexData = nullptr;
+	mRenderOp.useIndexes = false;
+	mRenderOp.operationType = Ogre::RenderOperation::OT_LINE_LIST;
+	setMaterial(material);
+	setBoundingBox(Ogre::AxisAlignedBox(0.0f, 0.0f, 0.0f, t.getWidth(), t.getWidth(),
+				t.getHeightScale() + height + 1.0f));
+	reserve(64);
+}
+
+OrderLineBatch::~OrderLineBatch()
+{
+	delete mRenderOp.vertexData;
+}
+
+// Returns the id of the segment.
+size_t OrderLineBatch::addSegment(const Ogre::Vector3& from, const Ogre::Vector3& to)
+{
+	size_t id;
+	if(!mFreeSegments.empty()) {
+		id = mFreeSegments.back();
+		mFreeSegments.pop_back();
+	}
+	else {
+		if(mNumSegments == mCapacity)
+			reserve(mCapacity * 2);
+		id = mNumSegments++;
+	}
+	setSegment(id, from, to);
+	return id;
+}
+
+void OrderLineBatch::setSegment(size_t id, const Ogre::Vector3& from, const Ogre::Vector3& to)
+{
+	float* v = &mVertices[id * SEGMENT_FLOATS];
+	float fromz = from.z + mHeight;
+	float toz = to.z + mHeight;
+	if(v[0] == from.x && v[1] == from.y && v[2] == fromz &&
+			v[3] == to.x && v[4] == to.y && v[5] == toz)
+		return;
+	v[0] = from.x;
+	v[1] = from.y;
+	v[2] = fromz;
+	v[3] = to.x;
+	v[4] = to.y;
+	v[5] = toz;
+	if(mDirtyBegin == mDirtyEnd) {
+		mDirtyBegin = id;
+		mDirtyEnd = id + 1;
+	}
+	else {
+		mDirtyBegin = std::min(mDirtyBegin, id);
+		mDirtyEnd = std::max(mDirtyEnd, id + 1);
+	}
+}
+
+void OrderLineBatch::removeSegment(size_t id)
+{
+	setSegment(id, Ogre::Vector3::ZERO, Ogre::Vector3::ZERO);
+	mFreeSegments.push_back(id);
+}
+
+// Writes the changed segments to the vertex buffer. To be called once
+// per frame before rendering.
+void OrderLineBatch::update()
+{
+	mRenderOp.vertexData->vertexCount = mNumSegments * 2;
+	if(mDirtyBegin == mDirtyEnd)
+		return;
+	Ogre::HardwareVertexBufferSharedPtr vbuf = mRenderOp.vertexData->vertexBufferBinding->getBuffer(0);
+	vbuf->writeData(mDirtyBegin * SEGMENT_FLOATS * sizeof(float),
+			(mDirtyEnd - mDirtyBegin) * SEGMENT_FLOATS * sizeof(float),
+			&mVertices[mDirtyBegin * SEGMENT_FLOATS]);
+	mDirtyBegin = mDirtyEnd = 0;
+}
+
+// Replaces the vertex buffer with a larger one, which is filled on the
+// next update.
+void OrderLineBatch::reserve(size_t segments)
+{
+	mCapacity = segments;
+	mVertices.resize(mCapacity * SEGMENT_FLOATS, 0.0f);
+	Ogre::HardwareVertexBufferSharedPtr vbuf = Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
+			SEGMENT_FLOATS / 2 * sizeof(float), mCapacity * 2,
+			Ogre::HardwareBuffer::HBU_DYNAMIC_WRITE_ONLY);
+	mRenderOp.vertexData->vertexBufferBinding->setBinding(0, vbuf);
+	mDirtyBegin = 0;
+	mDirtyEnd = mNumSegments;
+}
+
+Ogre::Real OrderLineBatch::getSquaredViewDepth(const Ogre::Camera* cam) const
+{
+	return (getParentNode()->_getDerivedPosition() - cam->getDerivedPosition()).squaredLength();
+}
+
+Ogre::Real OrderLineBatch::getBoundingRadius() const
+{
+	return mBoundingRadius;
+}
+
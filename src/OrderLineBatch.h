@@ -0,0 +1,38 @@
+#ifndef ORDERLINEBATCH_H
+#define ORDERLINEBATCH_H
+
+#include <vector>
+
+#include <Ogre.h>
+
+#include "Terrain.h"
+
+// Line segments drawn from one vertex buffer that is kept over frames.
+// A segment is added once and then moved in place; removed segments are
+// collapsed to a point and their slots reused. Only the slots changed
+// since the last update are written to the buffer. The segment ends are
+// given on the ground and drawn at the given height above it.
+class OrderLineBatch : public Ogre::SimpleRenderable {
+	public:
+		OrderLineBatch(const std::string& material, const Terrain& t, float height);
+		~OrderLineBatch();
+		size_t addSegment(const Ogre::Vector3& from, const Ogre::Vector3& to);
+		void setSegment(size_t id, const Ogre::Vector3& from, const Ogre::Vector3& to);
+		void removeSegment(size_t id);
+		void update();
+		Ogre::Real getSquaredViewDepth(const Ogre::Camera* cam) const;
+		Ogre::Real getBoundingRadius() const;
+	private:
+		void reserve(size_t segments);
+		float mHeight;
+		float mBoundingRadius;
+		size_t mCapacity;
+		size_t mNumSegments;
+		size_t mDirtyBegin;
+		size_t mDirtyEnd;
+		std::vector<float> mVertices;
+		std::vector<size_t> mFreeSegments;
+};
+
+#endif
+
@@ -1,14 +1,32 @@
 #include <iostream>
 #include <stdexcept>
 #include <algorithm>
+#include <fstream>
 
 #include "Papaya.h"
+#include "Trace.h"
 
 static const float maximum_tank_vegetation = 0.2f;
+static const float visibility_check_interval = 1.0f;
+static const size_t default_visibility_query_budget = 256;
+static const float sight_range = 4.0f;
+static const float travel_time_sample_distance = 1.0f;
+static const float minimum_speed = 0.05f;
+static const uint32_t checkpoint_magic = 0x44475242;
+static const uint32_t checkpoint_version = 2;
+static const unsigned int replay_hash_interval = 100;
+// the platoon cells and the fog of war share one grid, so that the
+// centre of a fog cell finds the platoons in it
+static const int platoon_grid_cells = 128;
 
 Papaya::Papaya()
 	: mTime(100),
-	mPlatoonCells(1, 1)
+	mTick(0),
+	mRandomSeed(0),
+	mPlatoonCells(1, 1),
+	mPresence(1, 1),
+	mVisibility(visibility_check_interval, default_visibility_query_budget),
+	mFog(1, 1, sight_range)
 {
 }
 
@@ -53,23 +71,64 @@ void Papaya::setup(const Terrain* t)
 	armyConfiguration.push_back(ServiceBranch::Recon);
 	armyConfiguration.push_back(ServiceBranch::Signal);
 	armyConfiguration.push_back(ServiceBranch::Supply);
-	mPlatoonCells = CellPartitioning<Platoon*>(mTerrain->getWidth(), 128);
+	mPlatoonCells = CellPartitioning<Platoon*>(mTerrain->getWidth(), platoon_grid_cells);
+	mPresence = PresenceGrid(mTerrain->getWidth(), 16);
+	mSight.setup(*mTerrain, 256);
+	mFog = FogOfWar(mTerrain->getWidth(), platoon_grid_cells, sight_range);
+	mFog.setup(&mSight);
 	mArmies.push_back(std::shared_ptr<Army>(new Army(*mTerrain, base1, 1, armyConfiguration)));
 	mArmies.push_back(std::shared_ptr<Army>(new Army(*mTerrain, base2, 2, armyConfiguration)));
 }
 
 void Papaya::process(float dt)
 {
-	for(auto& a : mArmies) {
-		auto pl = a->update(dt);
-		for(auto p : pl) {
-			for(auto l : mListeners) {
-				l->PlatoonStatusChanged(p);
-			}
+	TRACE_ZONE("Papaya::process");
+	if(mRecorder)
+		mRecorder->recordStep(mTick, dt);
+	{
+		TRACE_ZONE("Army update");
+		mChanged.clear();
+		for(auto& a : mArmies) {
+			a->update(dt, mChanged);
+		}
+	}
+	mVisibility.update(dt);
+	{
+		TRACE_ZONE("Platoon update");
+		mScheduler.update(dt, mChanged);
+	}
+	resolveCombat();
+	if(!mListeners.empty()) {
+		PlatoonSpan changed(mChanged.data(), mChanged.size());
+		PlatoonSpan died(mDied.data(), mDied.size());
+		for(auto l : mListeners) {
+			l->PlatoonsChanged(changed, died);
 		}
 	}
 	MessageDispatcher::instance().dispatchQueuedMessages();
 	mTime += dt * 0.1f;
+	mTick++;
+	if(mRecorder && mTick % replay_hash_interval == 0)
+		mRecorder->recordHash(mTick, getStateHash());
+}
+
+// Applies the damage of the engagements of this tick and announces the
+// killed platoons.
+void Papaya::resolveCombat()
+{
+	TRACE_ZONE("Combat");
+	mCombat.resolve(mDied);
+	for(auto p : mDied) {
+		removeEntityPosition(p);
+		// only the formations above the platoon need to refresh
+		// their lists of living subunits
+		for(MilitaryUnit* m = p->getCommandingUnit(); m; m = m->getCommandingUnit())
+			m->subunitDied();
+	}
+	for(auto p : mDied) {
+		MessageDispatcher::instance().dispatchMessage(Message(p->getEntityID(), WORLD_ENTITY_ID,
+					0.0f, 0.0f, MessageType::PlatoonDied, p));
+	}
 }
 
 const std::shared_ptr<Army> Papaya::getArmy(size_t side) const
@@ -103,10 +162,15 @@ Papaya& Papaya::instance()
 }
 
 float Papaya::getPlatoonSpeed(const Platoon& p) const
+{
+	return getSpeedAt(p.getBranch(), p.getPosition());
+}
+
+float Papaya::getSpeedAt(ServiceBranch b, const Vector2& pos) const
 {
 	float base = 1.0f;
-	float terraincoeff = mTerrain->getVegetationAt(p.getPosition());
-	if(branchOnFoot(p.getBranch())) {
+	float terraincoeff = mTerrain->getVegetationAt(pos);
+	if(branchOnFoot(b)) {
 		base *= 5.0f * (1.0f - terraincoeff);
 	}
 	else {
@@ -115,11 +179,55 @@ float Papaya::getPlatoonSpeed(const Platoon& p) const
 	return base;
 }
 
+// Estimates the time to travel along a straight line by sampling the
+// speed at every unit of distance.
+float Papaya::getTravelTime(ServiceBranch b, const Vector2& from, const Vector2& to) const
+{
+	Vector2 diff = to - from;
+	float dist = diff.length();
+	int steps = int(dist / travel_time_sample_distance) + 1;
+	float steplen = dist / steps;
+	float t = 0.0f;
+	for(int i = 0; i < steps; i++) {
+		Vector2 pos = from + diff * ((i + 0.5f) / steps);
+		t += steplen / std::max(getSpeedAt(b, pos), minimum_speed);
+	}
+	return t;
+}
+
 float Papaya::getCurrentTime() const
 {
 	return mTime;
 }
 
+unsigned int Papaya::getCurrentTick() const
+{
+	return mTick;
+}
+
+void Papaya::setRandomSeed(uint64_t seed)
+{
+	mRandomSeed = seed;
+}
+
+// Random number in [0, 1) determined by the seed, the entity, the current
+// tick, the purpose and the counter, which distinguishes several draws
+// for the same purpose during one tick.
+float Papaya::getRandom(EntityID e, RandomPurpose p, unsigned int counter) const
+{
+	return randomBitsToFloat(counterRandom(mRandomSeed, e, mTick, p, counter));
+}
+
+void Papaya::addEngagement(Platoon* attacker, Platoon* target, float damage)
+{
+	mCombat.addEngagement(attacker, target, damage);
+}
+
+size_t Papaya::getNumEngagements() const
+{
+	return mCombat.getNumEngagements();
+}
+
 Platoon* Papaya::getNeighbouringPlatoons(Platoon* p, float range)
 {
 	mPlatoonCells.getNeighbouringEntities(p, range);
@@ -137,10 +245,293 @@ Platoon* Papaya::getNextNeighbouringPlatoon()
 void Papaya::updateEntityPosition(Platoon* p, const Vector2& oldpos)
 {
 	mPlatoonCells.updateEntity(p, oldpos);
+	mPresence.updateEntity(p->getSide(), oldpos, p->getPosition());
+	if(mFog.updateObserver(p, mEnteredCells)) {
+		discoverEnemiesInCells(p, mEnteredCells);
+		findObserver(p, oldpos);
+	}
 }
 
 void Papaya::addEntityPosition(Platoon* p)
 {
 	mPlatoonCells.addEntity(p);
+	mPresence.addEntity(p->getSide(), p->getPosition());
+	mFog.addObserver(p);
+}
+
+void Papaya::removeEntityPosition(Platoon* p)
+{
+	mPlatoonCells.removeEntity(p);
+	mPresence.removeEntity(p->getSide(), p->getPosition());
+	mFog.removeObserver(p);
+}
+
+bool Papaya::isVisibleTo(int side, const Platoon* p) const
+{
+	return mFog.isVisible(side, p->getPosition());
+}
+
+const std::vector<uint64_t>& Papaya::getVisibilityBits(int side)
+{
+	return mFog.getVisibilityBits(side);
+}
+
+int Papaya::getVisibilityGridSize() const
+{
+	return mFog.getNumCells();
+}
+
+// Enemies in the cells the platoon currently sees.
+void Papaya::findVisibleEnemies(const Platoon* p, std::vector<Platoon*>& enemies) const
+{
+	enemies.clear();
+	const std::vector<unsigned int>* cells = mFog.getObservedCells(p);
+	if(!cells)
+		return;
+	for(auto c : *cells) {
+		for(Platoon* e : mPlatoonCells.getEntitiesAt(mFog.getCellCentre(c))) {
+			if(e->getSide() != p->getSide() && !e->isDead())
+				enemies.push_back(e);
+		}
+	}
+}
+
+void Papaya::discoverEnemy(Platoon* observer, Platoon* enemy)
+{
+	MessageDispatcher::instance().dispatchMessage(Message(observer->getEntityID(), observer->getEntityID(),
+				0.0f, 0.0f, MessageType::EnemyDiscovered, enemy));
 }
 
+// The observer has moved and sees new cells - report the enemies in them.
+void Papaya::discoverEnemiesInCells(Platoon* observer, const std::vector<Vector2>& cells)
+{
+	std::vector<Platoon*> enemies;
+	for(auto& c : cells) {
+		for(Platoon* e : mPlatoonCells.getEntitiesAt(c)) {
+			if(e->getSide() != observer->getSide() && !e->isDead())
+				enemies.push_back(e);
+		}
+	}
+	for(auto e : enemies)
+		discoverEnemy(observer, e);
+}
+
+// The enemy has moved to another cell - if it moved into view of another
+// side, let the closest platoon that sees it know.
+void Papaya::findObserver(Platoon* enemy, const Vector2& oldpos)
+{
+	bool spotted = false;
+	for(auto& a : mArmies) {
+		int side = a->getSide();
+		if(side != enemy->getSide() && mFog.isVisible(side, enemy->getPosition()) &&
+				!mFog.isVisible(side, oldpos))
+			spotted = true;
+	}
+	if(!spotted)
+		return;
+
+	Platoon* observer = nullptr;
+	float dist = 0.0f;
+	const Vector2& pos = enemy->getPosition();
+	for(Platoon* p = getNeighbouringPlatoons(enemy, sight_range);
+			p != nullptr;
+			p = getNextNeighbouringPlatoon()) {
+		if(p->getSide() == enemy->getSide() || p->isDead() || !mFog.observes(p, pos))
+			continue;
+		float d = (p->getPosition() - pos).length2();
+		if(!observer || d < dist) {
+			observer = p;
+			dist = d;
+		}
+	}
+	if(observer)
+		discoverEnemy(observer, enemy);
+}
+
+bool Papaya::hasEnemiesNear(const Platoon* p, float range) const
+{
+	return mPresence.hasEnemiesNear(p->getSide(), p->getPosition(), range);
+}
+
+bool Papaya::hasLineOfSight(const Vector2& from, const Vector2& to) const
+{
+	return mSight.hasLineOfSight(from, to);
+}
+
+void Papaya::checkLineOfSight(const std::vector<SightQuery>& queries,
+		std::vector<bool>& results) const
+{
+	mSight.checkLineOfSight(queries, results);
+}
+
+void Papaya::addPlatoon(Platoon* p)
+{
+	mPlatoons.push_back(p);
+	mScheduler.addPlatoon(p);
+	mVisibility.addPlatoon(p);
+}
+
+void Papaya::wakePlatoon(Platoon* p)
+{
+	mScheduler.wake(p);
+}
+
+void Papaya::sleepPlatoon(Platoon* p)
+{
+	mScheduler.sleep(p);
+}
+
+// All platoons, dead or alive, in the order they were created. The list
+// doesn't change after setup.
+const std::vector<Platoon*>& Papaya::getPlatoons() const
+{
+	return mPlatoons;
+}
+
+size_t Papaya::getNumAwakePlatoons() const
+{
+	return mScheduler.getNumAwake();
+}
+
+size_t Papaya::getNumPlatoonsInTier(UpdateTier t) const
+{
+	return mScheduler.getNumInTier(t);
+}
+
+void Papaya::setVisibilityQueryBudget(size_t budget)
+{
+	mVisibility.setQueryBudget(budget);
+}
+
+size_t Papaya::getNumVisibilityChecks() const
+{
+	return mVisibility.getNumChecks();
+}
+
+
+// Writes the complete simulation state. The terrain and the unit
+// hierarchy are not written - the checkpoint can only be loaded after
+// setting up the same scenario.
+void Papaya::saveCheckpoint(std::vector<char>& data) const
+{
+	data.clear();
+	CheckpointWriter w(data);
+	w.write(checkpoint_magic);
+	w.write(checkpoint_version);
+	w.write(mTime);
+	w.write(mTick);
+	w.write(mRandomSeed);
+	w.write<unsigned int>(mArmies.size());
+	for(auto& a : mArmies) {
+		a->saveState(w);
+	}
+	// the views of the observers are written to save recomputing them
+	for(auto& a : mArmies) {
+		for(auto p : a->getPlatoons()) {
+			if(p->isDead())
+				continue;
+			const std::vector<unsigned int>* cells = mFog.getObservedCells(p);
+			w.writeVector(cells ? *cells : std::vector<unsigned int>());
+		}
+	}
+	mScheduler.saveState(w);
+	mVisibility.saveState(w);
+	MessageDispatcher::instance().saveState(w);
+}
+
+void Papaya::loadCheckpoint(const std::vector<char>& data)
+{
+	CheckpointReader r(data);
+	if(r.read<uint32_t>() != checkpoint_magic)
+		throw std::runtime_error("Not a checkpoint");
+	if(r.read<uint32_t>() != checkpoint_version)
+		throw std::runtime_error("Unsupported checkpoint version");
+	float time = r.read<float>();
+	unsigned int tick = r.read<unsigned int>();
+	uint64_t seed = r.read<uint64_t>();
+	if(r.read<unsigned int>() != mArmies.size())
+		throw std::runtime_error("Checkpoint does not match the number of armies");
+
+	// the position bookkeeping is rebuilt for the loaded positions
+	for(auto& a : mArmies) {
+		for(auto p : a->getPlatoons()) {
+			if(!p->isDead())
+				removeEntityPosition(p);
+		}
+	}
+	for(auto& a : mArmies) {
+		a->loadState(r);
+	}
+	std::vector<unsigned int> cells;
+	for(auto& a : mArmies) {
+		for(auto p : a->getPlatoons()) {
+			if(p->isDead())
+				continue;
+			r.readVector(cells);
+			mPlatoonCells.addEntity(p);
+			mPresence.addEntity(p->getSide(), p->getPosition());
+			mFog.addObserver(p, cells);
+		}
+	}
+	mScheduler.loadState(r);
+	mVisibility.loadState(r);
+	MessageDispatcher::instance().loadState(r);
+	if(!r.atEnd())
+		throw std::runtime_error("Checkpoint has trailing data");
+
+	mTime = time;
+	mTick = tick;
+	mRandomSeed = seed;
+}
+
+void Papaya::saveCheckpoint(const std::string& filename) const
+{
+	std::vector<char> data;
+	saveCheckpoint(data);
+	std::ofstream f(filename.c_str(), std::ios::binary);
+	f.write(data.data(), data.size());
+	if(!f)
+		throw std::runtime_error("Could not write checkpoint " + filename);
+}
+
+void Papaya::loadCheckpoint(const std::string& filename)
+{
+	std::ifstream f(filename.c_str(), std::ios::binary);
+	if(!f.is_open())
+		throw std::runtime_error("Could not open checkpoint " + filename);
+	std::vector<char> data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+	loadCheckpoint(data);
+}
+
+// FNV-1a hash of the checkpoint of the current state.
+uint64_t Papaya::getStateHash() const
+{
+	std::vector<char> data;
+	saveCheckpoint(data);
+	uint64_t hash = 14695981039346656037ULL;
+	for(char c : data) {
+		hash ^= (unsigned char)c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Dispatches an order given from outside the simulation, e.g. by the
+// player, recording it if a replay log is being recorded.
+void Papaya::injectOrder(const Message& m)
+{
+	if(mRecorder)
+		mRecorder->recordOrder(mTick, m);
+	MessageDispatcher::instance().dispatchMessage(m);
+}
+
+// The human controlled unit must already have its controller, or be -1.
+void Papaya::startRecording(const std::string& filename, EntityID humanUnit)
+{
+	mRecorder.reset(new ReplayRecorder(filename, mRandomSeed, humanUnit, getStateHash()));
+}
+
+void Papaya::stopRecording()
+{
+	mRecorder.reset();
+}
@@ -4,15 +4,31 @@
 #include <memory>
 #include <vector>
 #include <list>
+#include <string>
 
 #include "Terrain.h"
 #include "Messaging.h"
 #include "Army.h"
 #include "CellPartitioning.h"
+#include "ActivityScheduler.h"
+#include "PresenceGrid.h"
+#include "VisibilityScheduler.h"
+#include "LineOfSight.h"
+#include "FogOfWar.h"
+#include "Random.h"
+#include "CombatResolver.h"
+#include "Replay.h"
+#include "Utils.h"
 
+typedef Span<const Platoon* const> PlatoonSpan;
+
+// Called once per tick with the platoons that were updated during it
+// and the ones that died in it. The spans are only valid during the
+// call.
 class PapayaEventListener {
 	public:
-		virtual void PlatoonStatusChanged(const Platoon* p) = 0;
+		virtual ~PapayaEventListener() { }
+		virtual void PlatoonsChanged(PlatoonSpan changed, PlatoonSpan died) = 0;
 };
 
 class Papaya {
@@ -26,17 +42,66 @@ class Papaya {
 		void removeEventListener(PapayaEventListener* l);
 		static Papaya& instance();
 		float getPlatoonSpeed(const Platoon& p) const;
+		float getSpeedAt(ServiceBranch b, const Vector2& pos) const;
+		float getTravelTime(ServiceBranch b, const Vector2& from, const Vector2& to) const;
 		float getCurrentTime() const;
+		unsigned int getCurrentTick() const;
+		void setRandomSeed(uint64_t seed);
+		float getRandom(EntityID e, RandomPurpose p, unsigned int counter = 0) const;
+		void addEngagement(Platoon* attacker, Platoon* target, float damage);
+		size_t getNumEngagements() const;
 		Platoon* getNeighbouringPlatoons(Platoon* p, float range);
 		Platoon* getNextNeighbouringPlatoon();
 		void updateEntityPosition(Platoon* p, const Vector2& oldpos);
 		void addEntityPosition(Platoon* p);
+		void removeEntityPosition(Platoon* p);
+		bool hasEnemiesNear(const Platoon* p, float range) const;
+		bool hasLineOfSight(const Vector2& from, const Vector2& to) const;
+		void checkLineOfSight(const std::vector<SightQuery>& queries,
+				std::vector<bool>& results) const;
+		bool isVisibleTo(int side, const Platoon* p) const;
+		const std::vector<uint64_t>& getVisibilityBits(int side);
+		int getVisibilityGridSize() const;
+		void findVisibleEnemies(const Platoon* p, std::vector<Platoon*>& enemies) const;
+		void addPlatoon(Platoon* p);
+		void wakePlatoon(Platoon* p);
+		void sleepPlatoon(Platoon* p);
+		const std::vector<Platoon*>& getPlatoons() const;
+		size_t getNumAwakePlatoons() const;
+		size_t getNumPlatoonsInTier(UpdateTier t) const;
+		void setVisibilityQueryBudget(size_t budget);
+		size_t getNumVisibilityChecks() const;
+		void saveCheckpoint(std::vector<char>& data) const;
+		void loadCheckpoint(const std::vector<char>& data);
+		void saveCheckpoint(const std::string& filename) const;
+		void loadCheckpoint(const std::string& filename);
+		uint64_t getStateHash() const;
+		void injectOrder(const Message& m);
+		void startRecording(const std::string& filename, EntityID humanUnit);
+		void stopRecording();
 	private:
+		void resolveCombat();
+		void discoverEnemy(Platoon* observer, Platoon* enemy);
+		void discoverEnemiesInCells(Platoon* observer, const std::vector<Vector2>& cells);
+		void findObserver(Platoon* enemy, const Vector2& oldpos);
 		const Terrain* mTerrain;
 		std::vector<std::shared_ptr<Army>> mArmies;
 		std::vector<PapayaEventListener*> mListeners;
 		float mTime;
+		unsigned int mTick;
+		uint64_t mRandomSeed;
 		CellPartitioning<Platoon*> mPlatoonCells;
+		PresenceGrid mPresence;
+		ActivityScheduler mScheduler;
+		VisibilityScheduler mVisibility;
+		LineOfSight mSight;
+		FogOfWar mFog;
+		std::vector<Vector2> mEnteredCells;
+		CombatResolver mCombat;
+		std::vector<Platoon*> mChanged;
+		std::vector<Platoon*> mDied;
+		std::unique_ptr<ReplayRecorder> mRecorder;
+		std::vector<Platoon*> mPlatoons;
 };
 
 #endif
@@ -1,37 +1,161 @@
 #include <iostream>
+#include <stdexcept>
 
 #include "Papaya.h"
 #include "PlatoonAI.h"
 #include "Army.h"
 
+size_t PlatoonAIController::sMaxStateDepth = 0;
+
+static const BehaviourTree& getPlatoonTree()
+{
+	static BehaviourTree tree = BehaviourTree::load("share/platoon.bt");
+	return tree;
+}
+
 PlatoonAIController::PlatoonAIController(Platoon* p)
-	: PlatoonController(p)
+	: PlatoonController(p),
+	mNumStates(0),
+	mBlackboard(getPlatoonTree().getNumVariables())
 {
-	mControllerStack.push(std::unique_ptr<PlatoonAIState>(new PlatoonAIDefendState(mUnit, this)));
+	pushController<PlatoonAIDefendState>();
+}
+
+PlatoonAIController::~PlatoonAIController()
+{
+	while(mNumStates)
+		popController();
 }
 
 bool PlatoonAIController::control(float dt)
 {
-	if(mControllerStack.empty())
-		mControllerStack.push(std::unique_ptr<PlatoonAIState>(new PlatoonAIDefendState(mUnit, this)));
-	return mControllerStack.top()->control(dt);
+	if(!mNumStates)
+		pushController<PlatoonAIDefendState>();
+	return getState(mNumStates - 1)->control(dt);
 }
 
 void PlatoonAIController::receiveMessage(const Message& m)
 {
-	if(mControllerStack.empty())
-		mControllerStack.push(std::unique_ptr<PlatoonAIState>(new PlatoonAIDefendState(mUnit, this)));
-	mControllerStack.top()->receiveMessage(m);
+	if(!mNumStates)
+		pushController<PlatoonAIDefendState>();
+	if(!getPlatoonTree().run(*this, m, mBlackboard.data()))
+		std::cout << "Unhandled message " << int(m.mType) << " in PlatoonAIController.\n";
 }
 
-void PlatoonAIController::pushController(std::unique_ptr<PlatoonAIState> c)
+bool PlatoonAIController::runBehaviour(const BehaviourNode& n, const Message& m)
 {
-	mControllerStack.push(std::move(c));
+	PlatoonAIState* state = getState(mNumStates - 1);
+	switch(n.mType) {
+		case BehaviourNodeType::HasPosture:
+			return int(state->getPosture()) == n.mArg;
+
+		case BehaviourNodeType::EnemyCloser:
+			{
+				Platoon* enemy = state->getEnemy();
+				return !enemy || mUnit->distanceTo(*m.mData->platoon) < mUnit->distanceTo(*enemy);
+			}
+
+		case BehaviourNodeType::MoveToPoint:
+			state->moveTo(m.mData->point);
+			return true;
+
+		case BehaviourNodeType::MoveToArea:
+			state->moveTo(Vector2((m.mData->area.x2 + m.mData->area.x1) / 2.0f,
+						(m.mData->area.y2 + m.mData->area.y1) / 2.0f));
+			return true;
+
+		case BehaviourNodeType::Engage:
+			state->engage(m.mData->platoon);
+			return true;
+
+		case BehaviourNodeType::Report:
+			MessageDispatcher::instance().dispatchMessage(Message(mUnit->getEntityID(), mUnit->getCommandingUnit()->getEntityID(),
+						0.0f, 0.0f, m.mType, *m.mData));
+			return true;
+
+		default:
+			return false;
+	}
 }
 
+Posture PlatoonAIController::getPosture() const
+{
+	if(!mNumStates)
+		return Posture::Holding;
+	return getState(mNumStates - 1)->getPosture();
+}
+
+// May be called by the topmost state itself, which must then not touch
+// its members afterwards.
 void PlatoonAIController::popController()
 {
-	mControllerStack.pop();
+	mNumStates--;
+	getState(mNumStates)->~PlatoonAIState();
+}
+
+// Each state is written with its posture, which identifies the state
+// class, followed by its constructor arguments, which are read here,
+// and the rest of its state.
+void PlatoonAIController::saveState(CheckpointWriter& w) const
+{
+	w.writeVector(mBlackboard);
+	w.write<unsigned int>(mNumStates);
+	for(size_t i = 0; i < mNumStates; i++) {
+		w.write(getState(i)->getPosture());
+		getState(i)->saveState(w);
+	}
+}
+
+void PlatoonAIController::loadState(CheckpointReader& r)
+{
+	r.readVector(mBlackboard);
+	if(mBlackboard.size() != getPlatoonTree().getNumVariables())
+		throw std::runtime_error("Checkpoint does not match the platoon behaviour tree");
+	while(mNumStates)
+		popController();
+	unsigned int numStates = r.read<unsigned int>();
+	if(numStates > MAX_PLATOON_AI_STATES)
+		throw std::runtime_error("Checkpoint has too many platoon AI states");
+	for(unsigned int i = 0; i < numStates; i++) {
+		switch(r.read<Posture>()) {
+			case Posture::Holding:
+				pushController<PlatoonAIDefendState>();
+				break;
+
+			case Posture::Moving:
+				pushController<PlatoonAIMoveState>(r.read<Vector2>());
+				break;
+
+			case Posture::Engaged:
+				pushController<PlatoonAICombatState>(r.readPlatoon());
+				break;
+
+			default:
+				throw std::runtime_error("Unknown platoon AI state in checkpoint");
+		}
+		getState(i)->loadState(r);
+	}
+}
+
+size_t PlatoonAIController::getStateDepth() const
+{
+	return mNumStates;
+}
+
+// Deepest state stack of any platoon so far.
+size_t PlatoonAIController::getMaxStateDepth()
+{
+	return sMaxStateDepth;
+}
+
+PlatoonAIState* PlatoonAIController::getState(size_t i)
+{
+	return reinterpret_cast<PlatoonAIState*>(&mStates[i]);
+}
+
+const PlatoonAIState* PlatoonAIController::getState(size_t i) const
+{
+	return reinterpret_cast<const PlatoonAIState*>(&mStates[i]);
 }
 
 PlatoonAIState::PlatoonAIState(Platoon* p, PlatoonAIController* c)
@@ -40,6 +164,37 @@ PlatoonAIState::PlatoonAIState(Platoon* p, PlatoonAIController* c)
 {
 }
 
+// Messages are handled by the controller's behaviour tree, which calls
+// the hooks below.
+void PlatoonAIState::receiveMessage(const Message& m)
+{
+}
+
+void PlatoonAIState::moveTo(const Vector2& v)
+{
+	mAIController->pushController<PlatoonAIMoveState>(v);
+}
+
+void PlatoonAIState::engage(Platoon* p)
+{
+	mAIController->pushController<PlatoonAICombatState>(p);
+}
+
+Platoon* PlatoonAIState::getEnemy() const
+{
+	return nullptr;
+}
+
+void PlatoonAIState::saveState(CheckpointWriter& w) const
+{
+	mSteering.saveState(w);
+}
+
+void PlatoonAIState::loadState(CheckpointReader& r)
+{
+	mSteering.loadState(r);
+}
+
 PlatoonAIDefendState::PlatoonAIDefendState(Platoon* p, PlatoonAIController* c)
 	: PlatoonAIState(p, c),
 	mAsleep(false)
@@ -60,38 +215,27 @@ bool PlatoonAIDefendState::control(float dt)
 		mUnit->moveTowards(diffvec, dt);
 		ret = true;
 	}
+	else {
+		Papaya::instance().sleepPlatoon(mUnit);
+	}
 	return ret;
 }
 
-void PlatoonAIDefendState::receiveMessage(const Message& m)
+Posture PlatoonAIDefendState::getPosture() const
 {
-	switch(m.mType) {
-		case MessageType::Goto:
-			mAIController->pushController(std::unique_ptr<PlatoonAIState>(new PlatoonAIMoveState(mUnit, mAIController, m.mData->point)));
-			break;
-
-		case MessageType::ClaimArea:
-			{
-				Vector2 v((m.mData->area.x2 + m.mData->area.x1) / 2.0f,
-						(m.mData->area.y2 + m.mData->area.y1) / 2.0f);
-				mAIController->pushController(std::unique_ptr<PlatoonAIState>(new PlatoonAIMoveState(mUnit, mAIController, v)));
-			}
-			break;
-
-		case MessageType::EnemyDiscovered:
-			mAIController->pushController(std::unique_ptr<PlatoonAIState>(new PlatoonAICombatState(mUnit, mAIController, m.mData->platoon)));
-			MessageDispatcher::instance().dispatchMessage(Message(mUnit->getEntityID(), mUnit->getCommandingUnit()->getEntityID(),
-						0.0f, 0.0f, MessageType::EnemyDiscovered, m.mData->platoon));
-			break;
+	return Posture::Holding;
+}
 
-		case MessageType::AttackEnemy:
-			mAIController->pushController(std::unique_ptr<PlatoonAIState>(new PlatoonAICombatState(mUnit, mAIController, m.mData->platoon)));
-			break;
+void PlatoonAIDefendState::saveState(CheckpointWriter& w) const
+{
+	PlatoonAIState::saveState(w);
+	w.write(mAsleep);
+}
 
-		default:
-			std::cout << "Unhandled message " << int(m.mType) << " in PlatoonAIDefendState.\n";
-			break;
-	}
+void PlatoonAIDefendState::loadState(CheckpointReader& r)
+{
+	PlatoonAIState::loadState(r);
+	mAsleep = r.read<bool>();
 }
 
 PlatoonAIMoveState::PlatoonAIMoveState(Platoon* p, PlatoonAIController* c, const Vector2& t)
@@ -110,44 +254,33 @@ bool PlatoonAIMoveState::control(float dt)
 		mUnit->moveTowards(diffvec, dt);
 	}
 	else {
-		mAIController->pushController(std::unique_ptr<PlatoonAIState>(new PlatoonAIDefendState(mUnit, mAIController)));
-		MessageDispatcher::instance().dispatchMessage(Message(mUnit->getEntityID(), mUnit->getCommandingUnit()->getEntityID(),
+		// back to the state we were in before moving. This is done before
+		// telling the commander so that an order it gives in reaction
+		// isn't popped right away. The pop destroys this state, so the
+		// unit is copied first.
+		Platoon* unit = mUnit;
+		mAIController->popController();
+		MessageDispatcher::instance().dispatchMessage(Message(unit->getEntityID(), unit->getCommandingUnit()->getEntityID(),
 					0.0f, 0.0f, MessageType::ReachedPosition, MessageData()));
 	}
 	return true;
 }
 
-void PlatoonAIMoveState::receiveMessage(const Message& m)
+Posture PlatoonAIMoveState::getPosture() const
 {
-	switch(m.mType) {
-		case MessageType::Goto:
-			mTargetPos = m.mData->point;
-			mSteering.setSeek(mTargetPos);
-			break;
-
-		case MessageType::ClaimArea:
-			{
-				Vector2 v((m.mData->area.x2 + m.mData->area.x1) / 2.0f,
-						(m.mData->area.y2 + m.mData->area.y1) / 2.0f);
-				mTargetPos = v;
-				mSteering.setSeek(mTargetPos);
-			}
-			break;
-
-		case MessageType::EnemyDiscovered:
-			mAIController->pushController(std::unique_ptr<PlatoonAIState>(new PlatoonAICombatState(mUnit, mAIController, m.mData->platoon)));
-			MessageDispatcher::instance().dispatchMessage(Message(mUnit->getEntityID(), mUnit->getCommandingUnit()->getEntityID(),
-						0.0f, 0.0f, MessageType::EnemyDiscovered, m.mData->platoon));
-			break;
+	return Posture::Moving;
+}
 
-		case MessageType::AttackEnemy:
-			mAIController->pushController(std::unique_ptr<PlatoonAIState>(new PlatoonAICombatState(mUnit, mAIController, m.mData->platoon)));
-			break;
+void PlatoonAIMoveState::saveState(CheckpointWriter& w) const
+{
+	w.write(mTargetPos);
+	PlatoonAIState::saveState(w);
+}
 
-		default:
-			std::cout << "Unhandled message " << int(m.mType) << " in PlatoonAIMoveState.\n";
-			break;
-	}
+void PlatoonAIMoveState::moveTo(const Vector2& v)
+{
+	mTargetPos = v;
+	mSteering.setSeek(mTargetPos);
 }
 
 PlatoonAICombatState::PlatoonAICombatState(Platoon* p, PlatoonAIController* c, Platoon* ep)
@@ -161,38 +294,42 @@ PlatoonAICombatState::PlatoonAICombatState(Platoon* p, PlatoonAIController* c, P
 
 bool PlatoonAICombatState::control(float dt)
 {
+	if(mEnemyPlatoon->isDead()) {
+		mAIController->popController();
+		return true;
+	}
 	if((mUnit->getPosition() - mEnemyPlatoon->getPosition()).length() > 1.0f) {
 		mSteering.setSeek(mEnemyPlatoon->getPosition());
 		Vector2 diffvec = mSteering.steer();
 		mUnit->moveTowards(diffvec, dt);
 	}
 	else {
-		float damage = dt * (rand() % 100) * 0.01f;
-		mEnemyPlatoon->loseHealth(damage);
-		if(mEnemyPlatoon->isDead()) {
-			mAIController->popController();
-		}
+		// the damage is applied after all platoons have been updated
+		int roll = Papaya::instance().getRandom(mUnit->getEntityID(), RandomPurpose::CombatDamage) * 100;
+		float damage = dt * roll * 0.01f;
+		Papaya::instance().addEngagement(mUnit, mEnemyPlatoon, damage);
 	}
 	return true;
 }
 
-void PlatoonAICombatState::receiveMessage(const Message& m)
+Posture PlatoonAICombatState::getPosture() const
 {
-	switch(m.mType) {
-		case MessageType::EnemyDiscovered:
-			if(mUnit->distanceTo(*m.mData->platoon) < mUnit->distanceTo(*mEnemyPlatoon))
-				mEnemyPlatoon = m.mData->platoon;
-			MessageDispatcher::instance().dispatchMessage(Message(mUnit->getEntityID(), mUnit->getCommandingUnit()->getEntityID(),
-						0.0f, 0.0f, MessageType::EnemyDiscovered, m.mData->platoon));
-			break;
+	return Posture::Engaged;
+}
+
+void PlatoonAICombatState::engage(Platoon* p)
+{
+	mEnemyPlatoon = p;
+}
 
-		case MessageType::AttackEnemy:
-			// already in combat
-			break;
+Platoon* PlatoonAICombatState::getEnemy() const
+{
+	return mEnemyPlatoon;
+}
 
-		default:
-			std::cout << "Unhandled message " << int(m.mType) << " in PlatoonAICombatState.\n";
-			break;
-	}
+void PlatoonAICombatState::saveState(CheckpointWriter& w) const
+{
+	w.writePlatoon(mEnemyPlatoon);
+	PlatoonAIState::saveState(w);
 }
 
@@ -1,29 +1,27 @@
 #ifndef PLATOONAI_H
 #define PLATOONAI_H
 
-#include <memory>
-#include <stack>
+#include <stdexcept>
+#include <type_traits>
 
+#include "BehaviourTree.h"
 #include "Messaging.h"
 #include "Terrain.h"
 #include "MilitaryUnit.h"
 
-class PlatoonAIState;
-
-class PlatoonAIController : public PlatoonController {
-	public:
-		PlatoonAIController(Platoon* p);
-		bool control(float dt);
-		void receiveMessage(const Message& m);
-		void pushController(std::unique_ptr<PlatoonAIState> c);
-		void popController();
-	protected:
-		std::stack<std::unique_ptr<PlatoonAIState>> mControllerStack;
-};
+class PlatoonAIController;
 
 class PlatoonAIState : public PlatoonController {
 	public:
 		PlatoonAIState(Platoon* p, PlatoonAIController* c);
+		virtual ~PlatoonAIState() { }
+		virtual void receiveMessage(const Message& m);
+		virtual Posture getPosture() const = 0;
+		virtual void moveTo(const Vector2& v);
+		virtual void engage(Platoon* p);
+		virtual Platoon* getEnemy() const;
+		virtual void saveState(CheckpointWriter& w) const;
+		virtual void loadState(CheckpointReader& r);
 	protected:
 		PlatoonAIController* mAIController;
 };
@@ -32,7 +30,9 @@ class PlatoonAIDefendState : public PlatoonAIState {
 	public:
 		PlatoonAIDefendState(Platoon* p, PlatoonAIController* c);
 		virtual bool control(float dt);
-		virtual void receiveMessage(const Message& m);
+		virtual Posture getPosture() const;
+		virtual void saveState(CheckpointWriter& w) const;
+		virtual void loadState(CheckpointReader& r);
 	protected:
 		bool mAsleep;
 };
@@ -41,7 +41,9 @@ class PlatoonAIMoveState : public PlatoonAIState {
 	public:
 		PlatoonAIMoveState(Platoon* p, PlatoonAIController* c, const Vector2& t);
 		virtual bool control(float dt);
-		virtual void receiveMessage(const Message& m);
+		virtual Posture getPosture() const;
+		virtual void moveTo(const Vector2& v);
+		virtual void saveState(CheckpointWriter& w) const;
 	protected:
 		Vector2 mTargetPos;
 };
@@ -50,10 +52,57 @@ class PlatoonAICombatState : public PlatoonAIState {
 	public:
 		PlatoonAICombatState(Platoon* p, PlatoonAIController* c, Platoon* ep);
 		virtual bool control(float dt);
-		virtual void receiveMessage(const Message& m);
+		virtual Posture getPosture() const;
+		virtual void engage(Platoon* p);
+		virtual Platoon* getEnemy() const;
+		virtual void saveState(CheckpointWriter& w) const;
 	protected:
 		Platoon* mEnemyPlatoon;
 };
 
+// The platoon tree leads to at most defend, move and combat on top of
+// each other; a deeper stack is an error in the state transitions.
+#define MAX_PLATOON_AI_STATES 4
+
+// The states are kept in place in a fixed number of slots so that state
+// transitions don't allocate. Messages are handled by running the
+// platoon behaviour tree.
+class PlatoonAIController : public PlatoonController, public BehaviourAgent {
+	public:
+		PlatoonAIController(Platoon* p);
+		~PlatoonAIController();
+		bool control(float dt);
+		void receiveMessage(const Message& m);
+		Posture getPosture() const;
+		template<class S, class... Args> void pushController(Args&&... args);
+		void popController();
+		size_t getStateDepth() const;
+		static size_t getMaxStateDepth();
+		bool runBehaviour(const BehaviourNode& n, const Message& m);
+		void saveState(CheckpointWriter& w) const;
+		void loadState(CheckpointReader& r);
+	protected:
+		PlatoonAIState* getState(size_t i);
+		const PlatoonAIState* getState(size_t i) const;
+		typedef std::aligned_union<0, PlatoonAIDefendState, PlatoonAIMoveState,
+			PlatoonAICombatState>::type StateStorage;
+		StateStorage mStates[MAX_PLATOON_AI_STATES];
+		size_t mNumStates;
+		std::vector<float> mBlackboard;
+		static size_t sMaxStateDepth;
+};
+
+template<class S, class... Args>
+void PlatoonAIController::pushController(Args&&... args)
+{
+	static_assert(sizeof(S) <= sizeof(StateStorage), "State does not fit in the state storage");
+	if(mNumStates >= MAX_PLATOON_AI_STATES)
+		throw std::runtime_error("Platoon AI state stack full - increase MAX_PLATOON_AI_STATES");
+	new (&mStates[mNumStates]) S(mUnit, this, std::forward<Args>(args)...);
+	mNumStates++;
+	if(mNumStates > sMaxStateDepth)
+		sMaxStateDepth = mNumStates;
+}
+
 #endif
 
@@ -0,0 +1,71 @@
+#include <algorithm>
+
+#include "PresenceGrid.h"
+#include "Utils.h"
+
+PresenceGrid::PresenceGrid(float w, int cells)
+	: mNumCells(cells),
+	mCellWidth(w / (float)cells)
+{
+}
+
+void PresenceGrid::addEntity(int side, const Vector2& pos)
+{
+	getSideCells(side)[getCellIndex(pos)]++;
+}
+
+void PresenceGrid::removeEntity(int side, const Vector2& pos)
+{
+	getSideCells(side)[getCellIndex(pos)]--;
+}
+
+void PresenceGrid::updateEntity(int side, const Vector2& oldpos, const Vector2& newpos)
+{
+	size_t i = getCellIndex(oldpos);
+	size_t j = getCellIndex(newpos);
+	if(i != j) {
+		std::vector<unsigned short>& cells = getSideCells(side);
+		cells[i]--;
+		cells[j]++;
+	}
+}
+
+bool PresenceGrid::hasEnemiesNear(int side, const Vector2& pos, float range) const
+{
+	int x1 = getCellCoordinate(pos.x - range);
+	int x2 = getCellCoordinate(pos.x + range);
+	int y1 = getCellCoordinate(pos.y - range);
+	int y2 = getCellCoordinate(pos.y + range);
+	for(size_t s = 0; s < mSideCells.size(); s++) {
+		if((int)s == side || mSideCells[s].empty())
+			continue;
+		const std::vector<unsigned short>& cells = mSideCells[s];
+		for(int j = y1; j <= y2; j++) {
+			for(int i = x1; i <= x2; i++) {
+				if(cells[j * mNumCells + i])
+					return true;
+			}
+		}
+	}
+	return false;
+}
+
+int PresenceGrid::getCellCoordinate(float f) const
+{
+	return clamp(0, int(f / mCellWidth), mNumCells - 1);
+}
+
+size_t PresenceGrid::getCellIndex(const Vector2& v) const
+{
+	return getCellCoordinate(v.y) * mNumCells + getCellCoordinate(v.x);
+}
+
+std::vector<unsigned short>& PresenceGrid::getSideCells(int side)
+{
+	if((int)mSideCells.size() <= side)
+		mSideCells.resize(side + 1);
+	if(mSideCells[side].empty())
+		mSideCells[side].resize(mNumCells * mNumCells);
+	return mSideCells[side];
+}
+
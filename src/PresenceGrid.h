@@ -0,0 +1,29 @@
+#ifndef PRESENCEGRID_H
+#define PRESENCEGRID_H
+
+#include <vector>
+
+#include "Terrain.h"
+
+// Coarse per-side count of living units per cell, used for cheap
+// "are there enemies nearby" queries.
+class PresenceGrid {
+	public:
+		PresenceGrid(float w, int cells);
+		void addEntity(int side, const Vector2& pos);
+		void removeEntity(int side, const Vector2& pos);
+		void updateEntity(int side, const Vector2& oldpos, const Vector2& newpos);
+		bool hasEnemiesNear(int side, const Vector2& pos, float range) const;
+
+	private:
+		int getCellCoordinate(float f) const;
+		size_t getCellIndex(const Vector2& v) const;
+		std::vector<unsigned short>& getSideCells(int side);
+		std::vector<std::vector<unsigned short>> mSideCells;
+
+		int mNumCells;
+		float mCellWidth;
+};
+
+#endif
+
@@ -0,0 +1,38 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+// Stateless random numbers: every draw is a hash of the seed, the entity,
+// the tick, the purpose of the draw and a counter, so the result does not
+// depend on the order in which entities are updated.
+
+enum class RandomPurpose {
+	CombatDamage
+};
+
+inline uint64_t mixRandomBits(uint64_t z)
+{
+	// splitmix64 finaliser
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+inline uint64_t counterRandom(uint64_t seed, uint64_t entity, uint64_t tick,
+		RandomPurpose purpose, uint64_t counter)
+{
+	uint64_t z = mixRandomBits(seed + 0x9e3779b97f4a7c15ULL * (entity + 1));
+	z = mixRandomBits(z ^ (tick * 0x9e3779b97f4a7c15ULL));
+	z = mixRandomBits(z ^ (((uint64_t)purpose << 32) | (counter & 0xffffffff)));
+	return z;
+}
+
+// Uniformly distributed in [0, 1).
+inline float randomBitsToFloat(uint64_t bits)
+{
+	return (bits >> 40) * (1.0f / 16777216.0f);
+}
+
+#endif
+
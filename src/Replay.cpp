@@ -0,0 +1,134 @@
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+
+#include "Replay.h"
+#include "Papaya.h"
+
+static const uint32_t replay_magic = 0x4c505242;
+static const uint32_t replay_version = 1;
+
+static void readHeader(CheckpointReader& r, uint64_t& seed, EntityID& humanUnit, uint64_t& initialHash)
+{
+	if(r.read<uint32_t>() != replay_magic)
+		throw std::runtime_error("Not a replay log");
+	if(r.read<uint32_t>() != replay_version)
+		throw std::runtime_error("Unsupported replay log version");
+	seed = r.read<uint64_t>();
+	humanUnit = r.read<EntityID>();
+	initialHash = r.read<uint64_t>();
+}
+
+ReplayRecorder::ReplayRecorder(const std::string& filename, uint64_t seed, EntityID humanUnit,
+		uint64_t initialHash)
+	: mFilename(filename),
+	mWriter(mData),
+	mLastStep(0.0f),
+	mLastTick(0)
+{
+	mWriter.write(replay_magic);
+	mWriter.write(replay_version);
+	mWriter.write(seed);
+	mWriter.write(humanUnit);
+	mWriter.write(initialHash);
+}
+
+// The log is written when the recording ends.
+ReplayRecorder::~ReplayRecorder()
+{
+	mWriter.write(ReplayRecordType::End);
+	mWriter.write(mLastTick);
+	std::ofstream f(mFilename.c_str(), std::ios::binary);
+	f.write(mData.data(), mData.size());
+	if(!f)
+		std::cerr << "Could not write the replay log " << mFilename << ".\n";
+}
+
+void ReplayRecorder::recordStep(unsigned int tick, float dt)
+{
+	if(dt != mLastStep) {
+		mWriter.write(ReplayRecordType::Step);
+		mWriter.write(tick);
+		mWriter.write(dt);
+		mLastStep = dt;
+	}
+	mLastTick = tick + 1;
+}
+
+void ReplayRecorder::recordOrder(unsigned int tick, const Message& m)
+{
+	mWriter.write(ReplayRecordType::Order);
+	mWriter.write(tick);
+	mWriter.writeMessage(m);
+}
+
+void ReplayRecorder::recordHash(unsigned int tick, uint64_t hash)
+{
+	mWriter.write(ReplayRecordType::Hash);
+	mWriter.write(tick);
+	mWriter.write(hash);
+}
+
+ReplayPlayer::ReplayPlayer(const std::string& filename)
+{
+	std::ifstream f(filename.c_str(), std::ios::binary);
+	if(!f.is_open())
+		throw std::runtime_error("Could not open replay log " + filename);
+	mData.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+	CheckpointReader r(mData);
+	readHeader(r, mSeed, mHumanUnit, mInitialHash);
+}
+
+uint64_t ReplayPlayer::getSeed() const
+{
+	return mSeed;
+}
+
+// The unit that was controlled by the player, or -1.
+EntityID ReplayPlayer::getHumanUnit() const
+{
+	return mHumanUnit;
+}
+
+// Returns true if the replay stayed in sync with the recording.
+bool ReplayPlayer::run()
+{
+	Papaya& papaya = Papaya::instance();
+	CheckpointReader r(mData);
+	readHeader(r, mSeed, mHumanUnit, mInitialHash);
+	papaya.setRandomSeed(mSeed);
+	if(papaya.getStateHash() != mInitialHash) {
+		std::cout << "Replay does not start from the recorded state.\n";
+		return false;
+	}
+	float dt = 0.0f;
+	unsigned int numHashes = 0;
+	while(1) {
+		ReplayRecordType type = r.read<ReplayRecordType>();
+		unsigned int tick = r.read<unsigned int>();
+		while(papaya.getCurrentTick() < tick)
+			papaya.process(dt);
+		switch(type) {
+			case ReplayRecordType::Step:
+				dt = r.read<float>();
+				break;
+
+			case ReplayRecordType::Order:
+				papaya.injectOrder(r.readMessage());
+				break;
+
+			case ReplayRecordType::Hash:
+				if(r.read<uint64_t>() != papaya.getStateHash()) {
+					std::cout << "Replay diverged at tick " << tick << ".\n";
+					return false;
+				}
+				numHashes++;
+				break;
+
+			case ReplayRecordType::End:
+				std::cout << "Replayed " << tick << " ticks, " << numHashes << " state hashes matched.\n";
+				return true;
+		}
+	}
+}
+
@@ -0,0 +1,53 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "Messaging.h"
+
+enum class ReplayRecordType : unsigned char {
+	Step,
+	Order,
+	Hash,
+	End
+};
+
+// Records what is needed to rerun a simulation: the random seed, the
+// human controlled unit, the time step whenever it changes and every
+// order given from outside the simulation. State hashes are recorded
+// every few ticks so that a replay can verify it stays in sync.
+class ReplayRecorder {
+	public:
+		ReplayRecorder(const std::string& filename, uint64_t seed, EntityID humanUnit,
+				uint64_t initialHash);
+		~ReplayRecorder();
+		void recordStep(unsigned int tick, float dt);
+		void recordOrder(unsigned int tick, const Message& m);
+		void recordHash(unsigned int tick, uint64_t hash);
+	private:
+		std::string mFilename;
+		std::vector<char> mData;
+		CheckpointWriter mWriter;
+		float mLastStep;
+		unsigned int mLastTick;
+};
+
+// Reruns a recorded simulation as fast as possible. The scenario must
+// have been set up before.
+class ReplayPlayer {
+	public:
+		ReplayPlayer(const std::string& filename);
+		uint64_t getSeed() const;
+		EntityID getHumanUnit() const;
+		bool run();
+	private:
+		std::vector<char> mData;
+		uint64_t mSeed;
+		EntityID mHumanUnit;
+		uint64_t mInitialHash;
+};
+
+#endif
+
@@ -0,0 +1,189 @@
+#include <algorithm>
+
+#include "SimulationThread.h"
+#include "Papaya.h"
+#include "Trace.h"
+
+// falling behind more than this many ticks drops the backlog
+static const unsigned int max_catch_up_ticks = 30;
+
+SimulationThread::SimulationThread(const Terrain& t, float step, float ticksPerSecond)
+	: mTerrain(t),
+	mStep(step),
+	mTicksPerSecond(ticksPerSecond),
+	mTimeScale(1.0f),
+	mMaxSpeed(false),
+	mRunning(false)
+{
+}
+
+SimulationThread::~SimulationThread()
+{
+	stop();
+}
+
+void SimulationThread::start()
+{
+	if(mRunning)
+		return;
+	publishFrame();
+	publishFrame();
+	mRunning = true;
+	mThread = std::thread(&SimulationThread::run, this);
+}
+
+void SimulationThread::stop()
+{
+	mRunning = false;
+	if(mThread.joinable())
+		mThread.join();
+}
+
+// Multiplies the number of ticks per second.
+void SimulationThread::setTimeScale(float scale)
+{
+	mTimeScale = scale;
+}
+
+void SimulationThread::setMaxSpeed(bool maxspeed)
+{
+	mMaxSpeed = maxspeed;
+}
+
+bool SimulationThread::getMaxSpeed() const
+{
+	return mMaxSpeed;
+}
+
+// The order is injected into the simulation before the next tick, and
+// its creation time is set then.
+void SimulationThread::postOrder(const Message& m)
+{
+	std::lock_guard<std::mutex> lock(mOrderMutex);
+	mOrders.push_back(m);
+}
+
+// Lets the simulation thread have the renderer do something, e.g. when
+// a message for the player arrives.
+void SimulationThread::postToRenderer(const std::function<void ()>& f)
+{
+	std::lock_guard<std::mutex> lock(mRendererMutex);
+	mRendererTasks.push_back(f);
+}
+
+void SimulationThread::runRendererTasks()
+{
+	std::exception_ptr error;
+	{
+		std::lock_guard<std::mutex> lock(mRendererMutex);
+		mPendingRendererTasks.swap(mRendererTasks);
+		error = mError;
+	}
+	if(error)
+		std::rethrow_exception(error);
+	for(auto& f : mPendingRendererTasks)
+		f();
+	mPendingRendererTasks.clear();
+}
+
+// Copies the last two frames and returns how far the renderer is from
+// the previous to the current frame, between 0 and 1.
+float SimulationThread::getFrames(SimulationFrame& previous, SimulationFrame& current) const
+{
+	std::lock_guard<std::mutex> lock(mFrameMutex);
+	previous = mPreviousFrame;
+	current = mCurrentFrame;
+	if(mMaxSpeed)
+		return 1.0f;
+	std::chrono::duration<float> since = std::chrono::steady_clock::now() - mFrameTime;
+	std::chrono::duration<float> interval = getTickInterval();
+	return std::min(1.0f, since.count() / interval.count());
+}
+
+void SimulationThread::run()
+{
+	TRACE_THREAD("simulation");
+	auto next = std::chrono::steady_clock::now();
+	try {
+		while(mRunning) {
+			if(mMaxSpeed) {
+				tick();
+				next = std::chrono::steady_clock::now();
+				continue;
+			}
+			auto now = std::chrono::steady_clock::now();
+			if(now < next) {
+				std::this_thread::sleep_until(next);
+				continue;
+			}
+			tick();
+			auto interval = getTickInterval();
+			next += interval;
+			if(now - next > interval * max_catch_up_ticks)
+				next = now;
+		}
+	} catch (...) {
+		// the renderer thread rethrows it so that main can report it
+		std::lock_guard<std::mutex> lock(mRendererMutex);
+		mError = std::current_exception();
+		mRunning = false;
+	}
+}
+
+void SimulationThread::tick()
+{
+	TRACE_ZONE("Tick");
+	auto start = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lock(mOrderMutex);
+		mPendingOrders.swap(mOrders);
+	}
+	for(auto& m : mPendingOrders) {
+		m.mCreationTime = Papaya::instance().getCurrentTime();
+		m.mSendTime = m.mCreationTime;
+		Papaya::instance().injectOrder(m);
+	}
+	mPendingOrders.clear();
+	Papaya::instance().process(mStep);
+	publishFrame();
+	mTickTimes.addSample(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+}
+
+// Called after each tick, or by others while the thread is not running.
+void SimulationThread::publishFrame()
+{
+	TRACE_ZONE("Publish frame");
+	const std::vector<Platoon*>& platoons = Papaya::instance().getPlatoons();
+	mNextFrame.mTick = Papaya::instance().getCurrentTick();
+	mNextFrame.mPlatoons.resize(platoons.size());
+	for(size_t i = 0; i < platoons.size(); i++) {
+		PlatoonFrame& f = mNextFrame.mPlatoons[i];
+		f.mPosition = platoons[i]->getPosition();
+		f.mAlive = !platoons[i]->isDead();
+		// the frames are only written here, so the current one can be
+		// read without the lock
+		if(i < mCurrentFrame.mPlatoons.size() &&
+				mCurrentFrame.mPlatoons[i].mPosition.x == f.mPosition.x &&
+				mCurrentFrame.mPlatoons[i].mPosition.y == f.mPosition.y)
+			f.mGroundHeight = mCurrentFrame.mPlatoons[i].mGroundHeight;
+		else
+			f.mGroundHeight = mTerrain.getHeightAt(f.mPosition) * mTerrain.getHeightScale();
+	}
+	std::lock_guard<std::mutex> lock(mFrameMutex);
+	std::swap(mPreviousFrame, mCurrentFrame);
+	std::swap(mCurrentFrame, mNextFrame);
+	mFrameTime = std::chrono::steady_clock::now();
+}
+
+// Time taken by each tick, including publishing the frame.
+const TimeHistogram& SimulationThread::getTickTimes() const
+{
+	return mTickTimes;
+}
+
+std::chrono::steady_clock::duration SimulationThread::getTickInterval() const
+{
+	std::chrono::duration<float> d(1.0f / (mTicksPerSecond * mTimeScale));
+	return std::chrono::duration_cast<std::chrono::steady_clock::duration>(d);
+}
+
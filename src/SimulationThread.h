@@ -0,0 +1,84 @@
+#ifndef SIMULATIONTHREAD_H
+#define SIMULATIONTHREAD_H
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Clock.h"
+#include "Messaging.h"
+#include "Terrain.h"
+
+// The ground height is looked up when the platoon moves, so that the
+// renderer needs not sample the terrain for each marker every frame.
+struct PlatoonFrame {
+	Vector2 mPosition;
+	float mGroundHeight;
+	bool mAlive;
+};
+
+// The platoon states after a tick, in the order of Papaya::getPlatoons().
+struct SimulationFrame {
+	SimulationFrame() : mTick(0) { }
+	unsigned int mTick;
+	std::vector<PlatoonFrame> mPlatoons;
+};
+
+// Runs Papaya on its own thread with a fixed time step. Normally the
+// ticks are paced to the time scale, running several ticks to catch up
+// if the thread has fallen behind; in max speed mode they are run back
+// to back. The state after each tick is published as a frame, and the
+// last two frames are available to the renderer for interpolation.
+// While the thread is running, other threads must not touch the
+// simulation but give orders through postOrder. If a tick throws, the
+// thread stops and the exception is rethrown by runRendererTasks.
+class SimulationThread {
+	public:
+		SimulationThread(const Terrain& t, float step, float ticksPerSecond);
+		~SimulationThread();
+		void start();
+		void stop();
+		void setTimeScale(float scale);
+		void setMaxSpeed(bool maxspeed);
+		bool getMaxSpeed() const;
+		void postOrder(const Message& m);
+		void postToRenderer(const std::function<void ()>& f);
+		void runRendererTasks();
+		float getFrames(SimulationFrame& previous, SimulationFrame& current) const;
+		void publishFrame();
+		const TimeHistogram& getTickTimes() const;
+	private:
+		void run();
+		void tick();
+		std::chrono::steady_clock::duration getTickInterval() const;
+		const Terrain& mTerrain;
+		float mStep;
+		float mTicksPerSecond;
+		std::atomic<float> mTimeScale;
+		std::atomic<bool> mMaxSpeed;
+		std::atomic<bool> mRunning;
+		std::thread mThread;
+		TimeHistogram mTickTimes;
+
+		mutable std::mutex mOrderMutex;
+		std::vector<Message> mOrders;
+		std::vector<Message> mPendingOrders;
+
+		mutable std::mutex mRendererMutex;
+		std::vector<std::function<void ()>> mRendererTasks;
+		std::vector<std::function<void ()>> mPendingRendererTasks;
+		std::exception_ptr mError;
+
+		mutable std::mutex mFrameMutex;
+		SimulationFrame mPreviousFrame;
+		SimulationFrame mCurrentFrame;
+		SimulationFrame mNextFrame;
+		std::chrono::steady_clock::time_point mFrameTime;
+};
+
+#endif
+
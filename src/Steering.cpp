@@ -4,9 +4,11 @@
 #include "Steering.h"
 #include "Papaya.h"
 #include "MilitaryUnit.h"
+#include "Trace.h"
 
 Steering::Steering(Platoon* p)
-	: mPlatoon(p)
+	: mPlatoon(p),
+	mNumSleepingNeighbours(0)
 {
 	clear();
 }
@@ -14,29 +16,62 @@ Steering::Steering(Platoon* p)
 void Steering::clear()
 {
 	memset(mSteerings, 0x00, sizeof(mSteerings));
-	mSteeringsActivated.clear();
+	mSteeringsActivated = 0;
+}
+
+void Steering::saveState(CheckpointWriter& w) const
+{
+	w.write(mSteerings);
+	w.write(mSteeringsActivated);
+	w.write(mSeekTarget);
+}
+
+// The sleeping neighbours are only kept during one steer() call and are
+// not saved.
+void Steering::loadState(CheckpointReader& r)
+{
+	r.readBytes(mSteerings, sizeof(mSteerings));
+	mSteeringsActivated = r.read<unsigned int>();
+	mSeekTarget = r.read<Vector2>();
+	mNumSleepingNeighbours = 0;
 }
 
 Vector2 Steering::steer()
 {
+	TRACE_ZONE("Steering");
 	Vector2 v;
+	mNumSleepingNeighbours = 0;
 	for(int i = 0; i < MAX_STEERINGS; i++) {
+		bool done = false;
 		switch(mSteerings[i]) {
 			case SteeringType::None:
-				return v;
+				done = true;
+				break;
 			case SteeringType::Seek:
-				if(seek(v))
-					return v;
+				done = seek(v);
 				break;
 			case SteeringType::Separation:
-				if(separate(v))
-					return v;
+				done = separate(v);
 				break;
 		}
+		if(done)
+			break;
 	}
+	// only a platoon that is about to move wakes up its neighbours, otherwise
+	// two settled platoons would keep each other awake.
+	if(v.length() > 0.1f)
+		wakeSleepingNeighbours();
 	return v;
 }
 
+void Steering::wakeSleepingNeighbours()
+{
+	for(int i = 0; i < mNumSleepingNeighbours; i++) {
+		Papaya::instance().wakePlatoon(mSleepingNeighbours[i]);
+	}
+	mNumSleepingNeighbours = 0;
+}
+
 bool Steering::seek(Vector2& v) const
 {
 #ifdef STEERING_DEBUG
@@ -46,13 +81,16 @@ bool Steering::seek(Vector2& v) const
 	return accumulateSteering(v, mSeekTarget - mPlatoon->getPosition());
 }
 
-bool Steering::separate(Vector2& v) const
+bool Steering::separate(Vector2& v)
 {
 	static const float maxSeparationDistance = 2.0f;
 	for(Platoon* p = Papaya::instance().getNeighbouringPlatoons(mPlatoon, maxSeparationDistance);
 			p != nullptr;
 			p = Papaya::instance().getNextNeighbouringPlatoon()) {
 		if(p->getSide() == mPlatoon->getSide() && !p->isDead()) {
+			if(p->getActivity() != Activity::Awake &&
+					mNumSleepingNeighbours < MAX_SLEEPING_NEIGHBOURS)
+				mSleepingNeighbours[mNumSleepingNeighbours++] = p;
 			Vector2 diff = mPlatoon->getPosition() - p->getPosition();
 			float vl = diff.length() / maxSeparationDistance;
 #ifdef STEERING_DEBUG
@@ -108,12 +146,12 @@ void Steering::setSeparation()
 
 void Steering::addSteering(enum SteeringType t)
 {
-	if(mSteeringsActivated.find(t) != mSteeringsActivated.end())
+	if(mSteeringsActivated & (1 << int(t)))
 		return;
 	for(int i = 0; i < MAX_STEERINGS; i++) {
 		if(mSteerings[i] == SteeringType::None) {
 			mSteerings[i] = t;
-			mSteeringsActivated.insert(t);
+			mSteeringsActivated |= 1 << int(t);
 			return;
 		}
 	}
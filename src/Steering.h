@@ -1,11 +1,11 @@
 #ifndef STEERING_H
 #define STEERING_H
 
-#include <set>
-
 #include "Terrain.h"
+#include "Checkpoint.h"
 
 #define MAX_STEERINGS 10
+#define MAX_SLEEPING_NEIGHBOURS 8
 
 class Platoon;
 
@@ -22,15 +22,20 @@ class Steering {
 		Vector2 steer();
 		void setSeek(const Vector2& tgt);
 		void setSeparation();
+		void saveState(CheckpointWriter& w) const;
+		void loadState(CheckpointReader& r);
 	private:
 		void addSteering(enum SteeringType t);
 		bool seek(Vector2& v) const;
-		bool separate(Vector2& v) const;
+		bool separate(Vector2& v);
+		void wakeSleepingNeighbours();
 		bool accumulateSteering(Vector2& accumulated, const Vector2& toAdd) const;
 		Platoon* mPlatoon;
 		SteeringType mSteerings[MAX_STEERINGS];
-		std::set<SteeringType> mSteeringsActivated;
+		unsigned int mSteeringsActivated;
 		Vector2 mSeekTarget;
+		Platoon* mSleepingNeighbours[MAX_SLEEPING_NEIGHBOURS];
+		int mNumSleepingNeighbours;
 };
 
 #endif
@@ -0,0 +1,325 @@
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+
+#include "TerrainRenderer.h"
+
+// terrain units per chunk side, one vertex per unit at full detail
+static const size_t chunk_size = 32;
+static const size_t chunk_vertices = chunk_size + 1;
+static const float skirt_depth = 1.0f;
+// the detail is halved at this distance from the camera and again at
+// every doubling of it
+static const float lod_distance = 64.0f;
+// so that adding the chunks doesn't stall a frame
+static const size_t max_chunk_uploads_per_frame = 2;
+// steps along the mouse ray when looking for the ground
+static const float ray_step = 0.25f;
+static const int max_ray_steps = 4096;
+
+// position, normal, texture coordinates
+#define TERRAIN_VERTEX_FLOATS 8
+
+TerrainChunk::TerrainChunk(const TerrainChunkData& data, const std::string& material, float loddistance)
+	: mLodDistance(loddistance),
+	mLevelOfDetail(0)
+{
+	size_t numvertices = data.mVertices.size() / TERRAIN_VERTEX_FLOATS;
+	mRenderOp.vertexData = new Ogre::VertexData();
+	mRenderOp.vertexData->vertexStart = 0;
+	mRenderOp.vertexData->vertexCount = numvertices;
+	Ogre::VertexDeclaration* decl = mRenderOp.vertexData->vertexDeclaration;
+	size_t offset = 0;
+	offset += decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_POSITION).getSize();
+	offset += decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_NORMAL).getSize();
+	decl->addElement(0, offset, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES);
+	Ogre::HardwareVertexBufferSharedPtr vbuf = Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
+			decl->getVertexSize(0), numvertices,
+			Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+	vbuf->writeData(0, vbuf->getSizeInBytes(), &data.mVertices[0], true);
+	mRenderOp.vertexData->vertexBufferBinding->setBinding(0, vbuf);
+
+	for(auto& indices : data.mIndices) {
+		Ogre::IndexData* level = new Ogre::IndexData();
+		level->indexStart = 0;
+		level->indexCount = indices.size();
+		level->indexBuffer = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(
+				Ogre::HardwareIndexBuffer::IT_16BIT, indices.size(),
+				Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+		level->indexBuffer->writeData(0, level->indexBuffer->getSizeInBytes(), &indices[0], true);
+		mLevels.push_back(level);
+	}
+	mRenderOp.indexData = mLevels[0];
+	mRenderOp.useIndexes = true;
+	mRenderOp.operationType = Ogre::RenderOperation::OT_TRIANGLE_LIST;
+	setMaterial(material);
+	setBoundingBox(data.mBounds);
+}
+
+TerrainChunk::~TerrainChunk()
+{
+	mRenderOp.indexData = nullptr;
+	for(auto level : mLevels)
+		delete level;
+	delete mRenderOp.vertexData;
+}
+
+// Picks the level of detail by the distance from the camera to the
+// closest point of the chunk.
+void TerrainChunk::_notifyCurrentCamera(Ogre::Camera* cam)
+{
+	Ogre::SimpleRenderable::_notifyCurrentCamera(cam);
+	const Ogre::Vector3& pos = cam->getDerivedPosition();
+	const Ogre::Vector3& mn = mBox.getMinimum();
+	const Ogre::Vector3& mx = mBox.getMaximum();
+	Ogre::Vector3 closest(std::max(mn.x, std::min(pos.x, mx.x)),
+			std::max(mn.y, std::min(pos.y, mx.y)),
+			std::max(mn.z, std::min(pos.z, mx.z)));
+	float dist = closest.distance(pos);
+	unsigned int lod = 0;
+	while(lod + 1 < mLevels.size() && dist > mLodDistance * (1 << lod))
+		lod++;
+	mLevelOfDetail = lod;
+	mRenderOp.indexData = mLevels[lod];
+}
+
+Ogre::Real TerrainChunk::getSquaredViewDepth(const Ogre::Camera* cam) const
+{
+	return mBox.getCenter().squaredDistance(cam->getDerivedPosition());
+}
+
+// The vertices are in world coordinates and the sphere is centred on the
+// node at the origin, so it must reach the farthest corner of the chunk.
+Ogre::Real TerrainChunk::getBoundingRadius() const
+{
+	return mBox.getMaximum().length();
+}
+
+unsigned int TerrainChunk::getLevelOfDetail() const
+{
+	return mLevelOfDetail;
+}
+
+TerrainRenderer::TerrainRenderer(const Terrain& t, Ogre::SceneManager* scene, const std::string& material)
+	: mTerrain(t),
+	mScene(scene),
+	mMaterial(material),
+	mStopped(false)
+{
+	mNumChunks = (size_t(mTerrain.getWidth()) + chunk_size - 1) / chunk_size;
+	mNode = mScene->getRootSceneNode()->createChildSceneNode();
+}
+
+TerrainRenderer::~TerrainRenderer()
+{
+	mStopped = true;
+	if(mBuilder.joinable())
+		mBuilder.join();
+	for(auto c : mChunks) {
+		mNode->detachObject(c);
+		delete c;
+	}
+	mScene->destroySceneNode(mNode);
+}
+
+void TerrainRenderer::start()
+{
+	mBuilder = std::thread(&TerrainRenderer::buildChunks, this);
+}
+
+// Adds the chunks built since the last frame to the scene. To be called
+// once per frame.
+void TerrainRenderer::update()
+{
+	std::vector<TerrainChunkData> ready;
+	{
+		std::lock_guard<std::mutex> lock(mReadyMutex);
+		if(mReady.empty())
+			return;
+		size_t num = std::min(mReady.size(), max_chunk_uploads_per_frame);
+		std::move(mReady.begin(), mReady.begin() + num, std::back_inserter(ready));
+		mReady.erase(mReady.begin(), mReady.begin() + num);
+	}
+	for(auto& data : ready) {
+		TerrainChunk* c = new TerrainChunk(data, mMaterial, lod_distance);
+		mNode->attachObject(c);
+		mChunks.push_back(c);
+	}
+	if(isReady())
+		std::cout << "Terrain ready: " << mChunks.size() << " chunks\n";
+}
+
+// Whether all chunks are in the scene.
+bool TerrainRenderer::isReady() const
+{
+	return mChunks.size() == mNumChunks * mNumChunks;
+}
+
+void TerrainRenderer::setMaterial(const std::string& material)
+{
+	mMaterial = material;
+	for(auto c : mChunks)
+		c->setMaterial(material);
+}
+
+// Marches along the ray until it is below the ground and then bisects
+// to the ground.
+bool TerrainRenderer::intersectRay(const Ogre::Ray& ray, Ogre::Vector3& point) const
+{
+	const Ogre::Vector3& origin = ray.getOrigin();
+	const Ogre::Vector3& dir = ray.getDirection();
+	float maxheight = mTerrain.getHeightScale();
+	if(dir.z >= 0.0f && origin.z > maxheight)
+		return false;
+
+	// start where the ray gets low enough to hit the ground
+	float t = 0.0f;
+	if(origin.z > maxheight)
+		t = (origin.z - maxheight) / -dir.z;
+	float prevt = t;
+	bool hit = false;
+	for(int i = 0; i < max_ray_steps; i++) {
+		Ogre::Vector3 p = ray.getPoint(t);
+		if(p.z <= getGroundHeight(Vector2(p.x, p.y))) {
+			hit = true;
+			break;
+		}
+		// going up above the highest hill
+		if(p.z > maxheight && dir.z >= 0.0f)
+			break;
+		prevt = t;
+		t += ray_step;
+	}
+	if(!hit)
+		return false;
+
+	for(int i = 0; i < 12; i++) {
+		float mid = (prevt + t) * 0.5f;
+		Ogre::Vector3 p = ray.getPoint(mid);
+		if(p.z <= getGroundHeight(Vector2(p.x, p.y)))
+			t = mid;
+		else
+			prevt = mid;
+	}
+	point = ray.getPoint(t);
+	return true;
+}
+
+float TerrainRenderer::getGroundHeight(const Vector2& v) const
+{
+	return mTerrain.getHeightAt(v) * mTerrain.getHeightScale();
+}
+
+void TerrainRenderer::buildChunks()
+{
+	for(size_t y = 0; y < mNumChunks; y++) {
+		for(size_t x = 0; x < mNumChunks; x++) {
+			if(mStopped)
+				return;
+			TerrainChunkData data;
+			data.mX = x;
+			data.mY = y;
+			buildChunk(data);
+			std::lock_guard<std::mutex> lock(mReadyMutex);
+			mReady.push_back(std::move(data));
+		}
+	}
+}
+
+void TerrainRenderer::buildChunk(TerrainChunkData& data) const
+{
+	const float width = mTerrain.getWidth();
+	const float x0 = data.mX * chunk_size;
+	const float y0 = data.mY * chunk_size;
+
+	// the heights with a border of one vertex for the normals
+	const size_t hw = chunk_vertices + 2;
+	std::vector<float> heights(hw * hw);
+	for(size_t j = 0; j < hw; j++)
+		for(size_t i = 0; i < hw; i++)
+			heights[j * hw + i] = getGroundHeight(Vector2(x0 + i - 1.0f, y0 + j - 1.0f));
+	auto height = [&](int i, int j) { return heights[(j + 1) * hw + i + 1]; };
+
+	float minz = heights[0];
+	float maxz = heights[0];
+	std::vector<float>& v = data.mVertices;
+	v.reserve((chunk_vertices * chunk_vertices + 4 * chunk_vertices) * TERRAIN_VERTEX_FLOATS);
+	for(int j = 0; j < int(chunk_vertices); j++) {
+		for(int i = 0; i < int(chunk_vertices); i++) {
+			float z = height(i, j);
+			Ogre::Vector3 normal(height(i - 1, j) - height(i + 1, j),
+					height(i, j - 1) - height(i, j + 1), 2.0f);
+			normal.normalise();
+			v.push_back(x0 + i);
+			v.push_back(y0 + j);
+			v.push_back(z);
+			v.push_back(normal.x);
+			v.push_back(normal.y);
+			v.push_back(normal.z);
+			// texel centres are at whole coordinates
+			v.push_back((x0 + i + 0.5f) / width);
+			v.push_back((y0 + j + 0.5f) / width);
+			minz = std::min(minz, z);
+			maxz = std::max(maxz, z);
+		}
+	}
+
+	// skirts along the bottom, top, left and right edges
+	auto edgeVertex = [](int edge, size_t k) -> size_t {
+		switch(edge) {
+			case 0: return k;
+			case 1: return chunk_size * chunk_vertices + k;
+			case 2: return k * chunk_vertices;
+			default: return k * chunk_vertices + chunk_size;
+		}
+	};
+	const size_t firstskirt = chunk_vertices * chunk_vertices;
+	for(int edge = 0; edge < 4; edge++) {
+		for(size_t k = 0; k < chunk_vertices; k++) {
+			size_t src = edgeVertex(edge, k) * TERRAIN_VERTEX_FLOATS;
+			for(int f = 0; f < TERRAIN_VERTEX_FLOATS; f++)
+				v.push_back(v[src + f]);
+			v[v.size() - TERRAIN_VERTEX_FLOATS + 2] -= skirt_depth;
+		}
+	}
+	data.mBounds = Ogre::AxisAlignedBox(x0, y0, minz - skirt_depth,
+			x0 + chunk_size, y0 + chunk_size, maxz);
+
+	for(size_t step = 1; step <= chunk_size; step *= 2) {
+		std::vector<Ogre::uint16> indices;
+		for(size_t j = 0; j < chunk_size; j += step) {
+			for(size_t i = 0; i < chunk_size; i += step) {
+				Ogre::uint16 v00 = j * chunk_vertices + i;
+				Ogre::uint16 v10 = v00 + step;
+				Ogre::uint16 v01 = v00 + step * chunk_vertices;
+				Ogre::uint16 v11 = v01 + step;
+				indices.push_back(v00);
+				indices.push_back(v10);
+				indices.push_back(v11);
+				indices.push_back(v00);
+				indices.push_back(v11);
+				indices.push_back(v01);
+			}
+		}
+		for(int edge = 0; edge < 4; edge++) {
+			for(size_t k = 0; k < chunk_size; k += step) {
+				// left and right as seen from outside the chunk
+				bool reverse = edge == 1 || edge == 2;
+				size_t l = reverse ? k + step : k;
+				size_t r = reverse ? k : k + step;
+				Ogre::uint16 lt = edgeVertex(edge, l);
+				Ogre::uint16 rt = edgeVertex(edge, r);
+				Ogre::uint16 lb = firstskirt + edge * chunk_vertices + l;
+				Ogre::uint16 rb = firstskirt + edge * chunk_vertices + r;
+				indices.push_back(lt);
+				indices.push_back(lb);
+				indices.push_back(rb);
+				indices.push_back(lt);
+				indices.push_back(rb);
+				indices.push_back(rt);
+			}
+		}
+		data.mIndices.push_back(indices);
+	}
+}
+
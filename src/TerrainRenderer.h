@@ -0,0 +1,74 @@
+#ifndef TERRAINRENDERER_H
+#define TERRAINRENDERER_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <Ogre.h>
+
+#include "Terrain.h"
+
+// The vertices of a chunk, built off the render thread. Each vertex is
+// a position, a normal and texture coordinates; the grid vertices are
+// followed by the skirt vertices hanging below the chunk edges. There
+// is one index list for each level of detail.
+struct TerrainChunkData {
+	size_t mX;
+	size_t mY;
+	std::vector<float> mVertices;
+	std::vector<std::vector<Ogre::uint16>> mIndices;
+	Ogre::AxisAlignedBox mBounds;
+};
+
+// A square of the terrain heightfield. All levels of detail share the
+// vertices; a coarser level only uses every second, fourth etc. vertex.
+// The skirts hide the cracks between chunks of different detail.
+class TerrainChunk : public Ogre::SimpleRenderable {
+	public:
+		TerrainChunk(const TerrainChunkData& data, const std::string& material, float loddistance);
+		~TerrainChunk();
+		void _notifyCurrentCamera(Ogre::Camera* cam);
+		Ogre::Real getSquaredViewDepth(const Ogre::Camera* cam) const;
+		Ogre::Real getBoundingRadius() const;
+		unsigned int getLevelOfDetail() const;
+	private:
+		std::vector<Ogre::IndexData*> mLevels;
+		float mLodDistance;
+		unsigned int mLevelOfDetail;
+};
+
+// Draws the terrain as a grid of chunks that are built by a background
+// thread and added to the scene as they become ready, so the map may be
+// large without stalling the frames. The scene manager culls the chunks
+// outside the view and each chunk picks its detail by its distance to
+// the camera.
+class TerrainRenderer {
+	public:
+		TerrainRenderer(const Terrain& t, Ogre::SceneManager* scene, const std::string& material);
+		~TerrainRenderer();
+		void start();
+		void update();
+		bool isReady() const;
+		void setMaterial(const std::string& material);
+		bool intersectRay(const Ogre::Ray& ray, Ogre::Vector3& point) const;
+		float getGroundHeight(const Vector2& v) const;
+	private:
+		void buildChunks();
+		void buildChunk(TerrainChunkData& data) const;
+		const Terrain& mTerrain;
+		Ogre::SceneManager* mScene;
+		Ogre::SceneNode* mNode;
+		std::string mMaterial;
+		size_t mNumChunks;
+		std::vector<TerrainChunk*> mChunks;
+
+		std::thread mBuilder;
+		std::atomic<bool> mStopped;
+		std::mutex mReadyMutex;
+		std::vector<TerrainChunkData> mReady;
+};
+
+#endif
+
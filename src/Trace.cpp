@@ -0,0 +1,134 @@
+#ifdef TRACING
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+
+#include "Trace.h"
+
+__thread TraceBuffer* tThreadTraceBuffer = nullptr;
+
+TraceBuffer::TraceBuffer(unsigned int threadid)
+	: mHead(0),
+	mThreadID(threadid)
+{
+}
+
+void TraceBuffer::setName(const char* name)
+{
+	mName = name;
+}
+
+// Copies the events still in the buffer. As the owning thread may still
+// be adding events, the ones that may have been overwritten while
+// copying are dropped.
+void TraceBuffer::getEvents(std::vector<TraceEvent>& events) const
+{
+	uint64_t head = mHead.load(std::memory_order_acquire);
+	uint64_t first = head > TRACE_BUFFER_SIZE ? head - TRACE_BUFFER_SIZE : 0;
+	std::vector<TraceEvent> copied;
+	copied.reserve(head - first);
+	for(uint64_t i = first; i < head; i++)
+		copied.push_back(mEvents[i & (TRACE_BUFFER_SIZE - 1)]);
+	uint64_t newhead = mHead.load(std::memory_order_acquire);
+	uint64_t valid = newhead > TRACE_BUFFER_SIZE ? newhead - TRACE_BUFFER_SIZE : 0;
+	for(uint64_t i = std::max(first, valid); i < head; i++)
+		events.push_back(copied[i - first]);
+}
+
+unsigned int TraceBuffer::getThreadID() const
+{
+	return mThreadID;
+}
+
+const std::string& TraceBuffer::getName() const
+{
+	return mName;
+}
+
+Trace::Trace()
+	: mStartTicks(now()),
+	mStartNanoseconds(getNanoseconds())
+{
+}
+
+static Trace singletonTrace;
+
+Trace& Trace::instance()
+{
+	return singletonTrace;
+}
+
+void Trace::setThreadName(const char* name)
+{
+	TraceBuffer& b = getThreadBuffer();
+	std::lock_guard<std::mutex> lock(mMutex);
+	b.setName(name);
+}
+
+uint64_t Trace::getNanoseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+// The buffers are kept after their threads have exited so that their
+// zones can still be written.
+TraceBuffer* Trace::addThread()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mBuffers.push_back(std::unique_ptr<TraceBuffer>(new TraceBuffer(mBuffers.size() + 1)));
+	return mBuffers.back().get();
+}
+
+// Writes the zones in the Chrome trace event format, with timestamps in
+// microseconds from the first zone.
+void Trace::writeChromeTrace(const char* filename)
+{
+	std::ofstream out(filename);
+	if(!out) {
+		std::cout << "Warning: could not open trace file " << filename << "\n";
+		return;
+	}
+
+	// the length of a tick is measured over the whole run so far
+	double elapsed = double(getNanoseconds() - mStartNanoseconds);
+	double ticks = double(now() - mStartTicks);
+	double ticksPerMicrosecond = elapsed > 0.0 && ticks > 0.0 ? ticks / elapsed * 1000.0 : 1000.0;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::vector<std::vector<TraceEvent>> events(mBuffers.size());
+	uint64_t begin = UINT64_MAX;
+	for(size_t i = 0; i < mBuffers.size(); i++) {
+		mBuffers[i]->getEvents(events[i]);
+		for(auto& e : events[i])
+			begin = std::min(begin, e.mStart);
+	}
+
+	out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+	bool first = true;
+	size_t numevents = 0;
+	for(size_t i = 0; i < mBuffers.size(); i++) {
+		unsigned int tid = mBuffers[i]->getThreadID();
+		if(!mBuffers[i]->getName().empty()) {
+			out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+				<< tid << ",\"args\":{\"name\":\"" << mBuffers[i]->getName() << "\"}}";
+			first = false;
+		}
+		for(auto& e : events[i]) {
+			out << (first ? "" : ",\n") << "{\"name\":\"" << e.mName
+				<< "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+				<< ",\"ts\":" << (e.mStart - begin) / ticksPerMicrosecond
+				<< ",\"dur\":" << (e.mEnd - e.mStart) / ticksPerMicrosecond << "}";
+			first = false;
+		}
+		numevents += events[i].size();
+	}
+	out << "\n]}\n";
+	std::cout << "Wrote " << numevents << " trace zones to " << filename << "\n";
+}
+
+#endif
+
@@ -0,0 +1,124 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Scoped zones for seeing where the time of a tick or a frame goes.
+// Build with TRACING defined (make TRACING=1) to enable them; otherwise
+// the macros compile to nothing.
+//
+//	TRACE_THREAD("simulation");	names the calling thread
+//	TRACE_ZONE("Steering");		times the rest of the scope
+//	TRACE_WRITE("trace.json");	writes a Chrome trace, viewable in
+//					chrome://tracing or Perfetto
+
+#ifdef TRACING
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+#if defined __x86_64__ || defined __i386__
+#include <x86intrin.h>
+#endif
+
+struct TraceEvent {
+	const char* mName;
+	uint64_t mStart;
+	uint64_t mEnd;
+};
+
+// must be a power of two
+#define TRACE_BUFFER_SIZE 65536
+
+// A ring buffer of the last zones of one thread. Only the owning thread
+// writes to it, so no locks are needed.
+class TraceBuffer {
+	public:
+		TraceBuffer(unsigned int threadid);
+		inline void add(const char* name, uint64_t start, uint64_t end);
+		void setName(const char* name);
+		void getEvents(std::vector<TraceEvent>& events) const;
+		unsigned int getThreadID() const;
+		const std::string& getName() const;
+	private:
+		TraceEvent mEvents[TRACE_BUFFER_SIZE];
+		std::atomic<uint64_t> mHead;
+		unsigned int mThreadID;
+		std::string mName;
+};
+
+class Trace {
+	public:
+		Trace();
+		static Trace& instance();
+		static inline uint64_t now();
+		static inline TraceBuffer& getThreadBuffer();
+		void setThreadName(const char* name);
+		void writeChromeTrace(const char* filename);
+	private:
+		static uint64_t getNanoseconds();
+		TraceBuffer* addThread();
+		uint64_t mStartTicks;
+		uint64_t mStartNanoseconds;
+		std::mutex mMutex;
+		std::vector<std::unique_ptr<TraceBuffer>> mBuffers;
+};
+
+class TraceZone {
+	public:
+		TraceZone(const char* name) : mName(name), mStart(Trace::now()) { }
+		~TraceZone() { Trace::getThreadBuffer().add(mName, mStart, Trace::now()); }
+	private:
+		const char* mName;
+		uint64_t mStart;
+};
+
+extern __thread TraceBuffer* tThreadTraceBuffer;
+
+void TraceBuffer::add(const char* name, uint64_t start, uint64_t end)
+{
+	uint64_t head = mHead.load(std::memory_order_relaxed);
+	TraceEvent& e = mEvents[head & (TRACE_BUFFER_SIZE - 1)];
+	e.mName = name;
+	e.mStart = start;
+	e.mEnd = end;
+	mHead.store(head + 1, std::memory_order_release);
+}
+
+// The time stamp counter where there is one, as it is much cheaper to
+// read than the system clock. The ticks are converted to nanoseconds
+// when the trace is written.
+uint64_t Trace::now()
+{
+#if defined __x86_64__ || defined __i386__
+	return __rdtsc();
+#else
+	return getNanoseconds();
+#endif
+}
+
+TraceBuffer& Trace::getThreadBuffer()
+{
+	if(!tThreadTraceBuffer)
+		tThreadTraceBuffer = instance().addThread();
+	return *tThreadTraceBuffer;
+}
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+#define TRACE_THREAD(name) Trace::instance().setThreadName(name)
+#define TRACE_WRITE(filename) Trace::instance().writeChromeTrace(filename)
+
+#else
+
+#define TRACE_ZONE(name)
+#define TRACE_THREAD(name)
+#define TRACE_WRITE(filename)
+
+#endif
+
+#endif
+
@@ -1,10 +1,28 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <cstddef>
+
 template<typename T>
 T clamp(const T& mn, const T& v, const T& mx)
 {
 	return std::max(mn, std::min(v, mx));
 }
 
+// A view of a contiguous array owned by someone else.
+template<typename T>
+class Span {
+	public:
+		Span() : mData(nullptr), mSize(0) { }
+		Span(T* data, size_t size) : mData(data), mSize(size) { }
+		T* begin() const { return mData; }
+		T* end() const { return mData + mSize; }
+		size_t size() const { return mSize; }
+		bool empty() const { return mSize == 0; }
+		T& operator[](size_t i) const { return mData[i]; }
+	private:
+		T* mData;
+		size_t mSize;
+};
+
 #endif
@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "VisibilityScheduler.h"
+#include "MilitaryUnit.h"
+#include "Trace.h"
+
+VisibilityScheduler::VisibilityScheduler(float interval, size_t budget)
+	: mNextPlatoon(0),
+	mInterval(interval),
+	mBudget(budget),
+	mCredit(0.0f),
+	mNumChecks(0)
+{
+}
+
+void VisibilityScheduler::addPlatoon(Platoon* p)
+{
+	mPlatoons.push_back(p);
+}
+
+void VisibilityScheduler::update(float dt)
+{
+	TRACE_ZONE("Visibility");
+	mNumChecks = 0;
+	if(mPlatoons.empty())
+		return;
+
+	// a backlog of more than one round is pointless
+	mCredit = std::min<float>(mCredit + mPlatoons.size() * dt / mInterval, mPlatoons.size());
+	while(mCredit >= 1.0f && mNumChecks < mBudget && !mPlatoons.empty()) {
+		if(mNextPlatoon >= mPlatoons.size())
+			mNextPlatoon = 0;
+		Platoon* p = mPlatoons[mNextPlatoon];
+		if(p->isDead()) {
+			mPlatoons[mNextPlatoon] = mPlatoons.back();
+			mPlatoons.pop_back();
+			continue;
+		}
+		p->checkVisibility();
+		mNextPlatoon++;
+		mNumChecks++;
+		mCredit -= 1.0f;
+	}
+}
+
+void VisibilityScheduler::setQueryBudget(size_t budget)
+{
+	mBudget = budget;
+}
+
+size_t VisibilityScheduler::getQueryBudget() const
+{
+	return mBudget;
+}
+
+// Number of visibility checks run during the last update.
+size_t VisibilityScheduler::getNumChecks() const
+{
+	return mNumChecks;
+}
+
+
+void VisibilityScheduler::saveState(CheckpointWriter& w) const
+{
+	w.write<unsigned int>(mPlatoons.size());
+	for(auto p : mPlatoons)
+		w.writePlatoon(p);
+	w.write<unsigned int>(mNextPlatoon);
+	w.write(mCredit);
+}
+
+void VisibilityScheduler::loadState(CheckpointReader& r)
+{
+	unsigned int n = r.read<unsigned int>();
+	mPlatoons.clear();
+	for(unsigned int i = 0; i < n; i++) {
+		Platoon* p = r.readPlatoon();
+		if(!p)
+			throw std::runtime_error("Checkpoint has an invalid platoon to check");
+		mPlatoons.push_back(p);
+	}
+	mNextPlatoon = r.read<unsigned int>();
+	mCredit = r.read<float>();
+	mNumChecks = 0;
+}
+
@@ -0,0 +1,34 @@
+#ifndef VISIBILITYSCHEDULER_H
+#define VISIBILITYSCHEDULER_H
+
+#include <stdlib.h>
+#include <vector>
+
+#include "Checkpoint.h"
+
+class Platoon;
+
+// Runs the platoon visibility checks round-robin, spreading them evenly
+// over the ticks so that each platoon is checked about once per check
+// interval, but never more checks in one tick than the query budget.
+class VisibilityScheduler {
+	public:
+		VisibilityScheduler(float interval, size_t budget);
+		void addPlatoon(Platoon* p);
+		void update(float dt);
+		void setQueryBudget(size_t budget);
+		size_t getQueryBudget() const;
+		size_t getNumChecks() const;
+		void saveState(CheckpointWriter& w) const;
+		void loadState(CheckpointReader& r);
+	private:
+		std::vector<Platoon*> mPlatoons;
+		size_t mNextPlatoon;
+		float mInterval;
+		size_t mBudget;
+		float mCredit;
+		size_t mNumChecks;
+};
+
+#endif
+
@@ -1,14 +1,116 @@
 #include <iostream>
+#include <map>
+#include <string.h>
 #include <stdlib.h>
 
 #include "App.h"
+#include "GUIController.h"
+#include "Trace.h"
+
+static const float headless_time_step = 0.01f;
+
+static void usage(const char* prog)
+{
+	std::cerr << "Usage: " << prog << " [--headless <ticks>] [--record <file>] [--replay <file>]\n"
+		<< "\t--headless <ticks>   run the simulation without graphics\n"
+		<< "\t--record <file>      record a replay log\n"
+		<< "\t--replay <file>      rerun a replay log without graphics and verify it\n";
+}
+
+// Counts the platoon updates and the losses of each side.
+class BattleStatistics : public PapayaEventListener {
+	public:
+		BattleStatistics()
+			: mTicks(0), mUpdates(0) { }
+		void PlatoonsChanged(PlatoonSpan changed, PlatoonSpan died)
+		{
+			mTicks++;
+			mUpdates += changed.size();
+			for(auto p : died)
+				mLosses[p->getSide()]++;
+		}
+		void print(std::ostream& os) const
+		{
+			os << "Platoon updates per tick: " << (mTicks ? mUpdates / double(mTicks) : 0.0) << "\n";
+			for(auto& l : mLosses)
+				os << "Side " << l.first << " lost " << l.second << " platoons\n";
+		}
+	private:
+		unsigned int mTicks;
+		unsigned long mUpdates;
+		std::map<int, unsigned int> mLosses;
+};
+
+// Runs the simulation without graphics as fast as possible.
+static int runHeadless(unsigned int ticks, const char* record, const char* replay)
+{
+	Terrain terrain;
+	Papaya::instance().setup(&terrain);
+	if(replay) {
+		ReplayPlayer player(replay);
+		EntityID human = player.getHumanUnit();
+		if(human != -1) {
+			// the player's orders are in the log, but the unit must
+			// otherwise behave as it did under the GUI
+			MilitaryUnit* m = dynamic_cast<MilitaryUnit*>(EntityManager::instance().getEntity(human));
+			if(!m)
+				throw std::runtime_error("The human controlled unit in the replay log does not exist");
+			m->setController(std::shared_ptr<GUIController>(new GUIController(nullptr, m)));
+		}
+		return player.run() ? 0 : 1;
+	}
+	if(record)
+		Papaya::instance().startRecording(record, -1);
+	TimeHistogram ticktimes;
+	BattleStatistics stats;
+	Papaya::instance().addEventListener(&stats);
+	for(unsigned int i = 0; i < ticks; i++) {
+		double start = Clock::getTime();
+		Papaya::instance().process(headless_time_step);
+		ticktimes.addSample(Clock::getTime() - start);
+	}
+	Papaya::instance().stopRecording();
+	Papaya::instance().removeEventListener(&stats);
+	ticktimes.print(std::cout, "Tick time");
+	stats.print(std::cout);
+	TRACE_WRITE("trace.json");
+	return 0;
+}
 
 int main(int argc, char** argv)
 {
+	bool headless = false;
+	unsigned int ticks = 0;
+	const char* record = nullptr;
+	const char* replay = nullptr;
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--headless") && i + 1 < argc) {
+			headless = true;
+			ticks = atoi(argv[++i]);
+		}
+		else if(!strcmp(argv[i], "--record") && i + 1 < argc) {
+			record = argv[++i];
+		}
+		else if(!strcmp(argv[i], "--replay") && i + 1 < argc) {
+			headless = true;
+			replay = argv[++i];
+		}
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
 	try {
-		srand(21);
+		Papaya::instance().setRandomSeed(21);
+		if(headless)
+			return runHeadless(ticks, record, replay);
 		App app;
+		if(record)
+			Papaya::instance().startRecording(record, app.getHumanUnit());
 		app.run();
+		Papaya::instance().stopRecording();
+		TRACE_WRITE("trace.json");
 	} catch (Ogre::Exception& e) {
 		std::cerr << "Ogre exception: " << e.what() << std::endl;
 		return 1;